@@ -39,7 +39,9 @@ static int NotWithinRange(int base, int extent)
 int SV_OrgVisibleBox(vec3_t org1, vec3_t mins, vec3_t maxs, vec3_t org2, int ignore, int rmg)
 {
 	trace_t tr;
+	traceSource_t oldSource;
 
+	oldSource = SV_SetTraceSource(TRACESRC_BOT);
 	if (rmg)
 	{
 		SV_Trace(&tr, org1, NULL, NULL, org2, ignore, MASK_SOLID, 0, 0, 10);
@@ -48,6 +50,7 @@ int SV_OrgVisibleBox(vec3_t org1, vec3_t mins, vec3_t maxs, vec3_t org2, int ign
 	{
 		SV_Trace(&tr, org1, mins, maxs, org2, ignore, MASK_SOLID, 0, 0, 10);
 	}
+	SV_SetTraceSource(oldSource);
 
 	if (tr.fraction == 1 && !tr.startsolid && !tr.allsolid)
 	{
@@ -307,8 +310,11 @@ BotImport_Trace
 */
 void BotImport_Trace(bsp_trace_t *bsptrace, vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, int passent, int contentmask) {
 	trace_t trace;
+	traceSource_t oldSource;
 
+	oldSource = SV_SetTraceSource(TRACESRC_BOT);
 	SV_Trace(&trace, start, mins, maxs, end, passent, contentmask, qfalse, 0, 10);
+	SV_SetTraceSource(oldSource);
 	//copy the trace information
 	bsptrace->allsolid = (qboolean)trace.allsolid;
 	bsptrace->startsolid = (qboolean)trace.startsolid;
@@ -357,7 +363,13 @@ BotImport_PointContents
 ==================
 */
 int BotImport_PointContents(vec3_t point) {
-	return SV_PointContents(point, -1);
+	traceSource_t oldSource;
+	int contents;
+
+	oldSource = SV_SetTraceSource(TRACESRC_BOT);
+	contents = SV_PointContents(point, -1);
+	SV_SetTraceSource(oldSource);
+	return contents;
 }
 
 /*
@@ -413,11 +425,7 @@ BotImport_GetMemoryGame
 */
 #ifndef _XBOX	// These are unused, I want the tag back
 void *Bot_GetMemoryGame(int size) {
-	void *ptr;
-
-	ptr = Z_Malloc( size, TAG_BOTGAME, qtrue );
-
-	return ptr;
+	return SV_PoolAlloc( size, POOL_BOTGAME );
 }
 
 /*
@@ -426,7 +434,7 @@ BotImport_FreeMemoryGame
 ==================
 */
 void Bot_FreeMemoryGame(void *ptr) {
-	Z_Free(ptr);
+	SV_PoolFree(ptr);
 }
 #endif
 /*
@@ -435,10 +443,7 @@ BotImport_GetMemory
 ==================
 */
 void *BotImport_GetMemory(int size) {
-	void *ptr;
-
-	ptr = Z_Malloc( size, TAG_BOTLIB, qtrue );
-	return ptr;
+	return SV_PoolAlloc( size, POOL_BOTLIB );
 }
 
 /*
@@ -447,7 +452,7 @@ BotImport_FreeMemory
 ==================
 */
 void BotImport_FreeMemory(void *ptr) {
-	Z_Free(ptr);
+	SV_PoolFree(ptr);
 }
 
 /*
@@ -616,12 +621,16 @@ it is changing to a different game directory.
 ===============
 */
 int SV_BotLibShutdown( void ) {
+	int		result;
 
 	if ( !botlib_export ) {
 		return -1;
 	}
 
-	return botlib_export->BotLibShutdown();
+	result = botlib_export->BotLibShutdown();
+	// botlib may still hold on to some of it across a restart, so only report
+	SV_PoolCheckLeaks( POOL_BOTLIB, qfalse );
+	return result;
 }
 
 /*
@@ -672,7 +681,7 @@ extern botlib_export_t *GetBotLibAPI( int apiVersion, botlib_import_t *import );
 static int bot_Z_AvailableMemory(void)
 {
 	const int iMaxBOTLIBMem = 8 * 1024 * 1024;	// adjust accordingly.
-	return iMaxBOTLIBMem - Z_MemSize( TAG_BOTLIB );
+	return iMaxBOTLIBMem - Z_MemSize( TAG_BOTLIB ) - SV_PoolSmallBytes( POOL_BOTLIB );
 }
 
 /*
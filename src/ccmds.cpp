@@ -259,7 +259,7 @@ static void SV_MapRestart_f( void ) {
 	}
 	if( delay ) {
 		sv.restartTime = svs.time + delay * 1000;
-		SV_SetConfigstring( CS_WARMUP, va("%i", sv.restartTime) );
+		SV_StoreConfigstring( CS_WARMUP, va("%i", sv.restartTime) );
 		return;
 	}
 
@@ -975,6 +975,14 @@ void SV_AddOperatorCommands( void ) {
 	Cmd_AddCommand ("dumpuser", SV_DumpUser_f);
 	Cmd_AddCommand ("map_restart", SV_MapRestart_f);
 	Cmd_AddCommand ("sectorlist", SV_SectorList_f);
+	Cmd_AddCommand ("tracetest", SV_TraceTest_f);
+	Cmd_AddCommand ("g2tracestats", SV_G2TraceStats_f);
+	Cmd_AddCommand ("tracestats", SV_TraceStats_f);
+	Cmd_AddCommand ("syscallprofile", SV_SyscallProfile_f);
+	Cmd_AddCommand ("timers", SV_PrecisionTimers_f);
+	Cmd_AddCommand ("poolstats", SV_PoolStats_f);
+	Cmd_AddCommand ("csstore", SV_Configstrings_f);
+	Cmd_AddCommand ("framestats", SV_FrameStats_f);
 	Cmd_AddCommand ("map", SV_Map_f);
 #ifndef PRE_RELEASE_DEMO
 	Cmd_AddCommand ("devmap", SV_Map_f);
@@ -991,6 +999,14 @@ void SV_AddOperatorCommands( void ) {
 	}
 
 	Cmd_AddCommand ("forcetoggle", SV_ForceToggle_f);
+	Cmd_AddCommand ("querystats", SV_QueryStats_f);
+
+	// SV_Init lives outside this module, register our own cvars alongside the commands
+	SV_InitQueryLimit();
+	SV_InitWorld();
+#ifndef _XBOX	// No downloads on Xbox
+	SV_InitDownloads();
+#endif
 }
 
 /*
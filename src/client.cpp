@@ -733,12 +733,10 @@ void SV_SendClientGameState( client_t *client ) {
 	MSG_WriteLong( &msg, client->reliableSequence );
 
 	// write the configstrings
-	for ( start = 0 ; start < MAX_CONFIGSTRINGS ; start++ ) {
-		if (sv.configstrings[start][0]) {
-			MSG_WriteByte( &msg, svc_configstring );
-			MSG_WriteShort( &msg, start );
-			MSG_WriteBigString( &msg, sv.configstrings[start] );
-		}
+	for ( start = SV_NextConfigstring( -1 ) ; start >= 0 ; start = SV_NextConfigstring( start ) ) {
+		MSG_WriteByte( &msg, svc_configstring );
+		MSG_WriteShort( &msg, start );
+		MSG_WriteBigString( &msg, SV_StoredConfigstring( start ) );
 	}
 
 	// write the baselines
@@ -972,6 +970,159 @@ CLIENT COMMAND EXECUTION
 ============================================================
 */
 
+#ifndef _XBOX	// No downloads on Xbox
+static downloadFile_t	*sv_downloadFiles;		// files currently being sent to someone
+static long long		sv_downloadFileBytes;	// total size of sv_downloadFiles
+
+/*
+==================
+SV_InitDownloads
+==================
+*/
+void SV_InitDownloads( void ) {
+	sv_dlCacheSize = Cvar_Get( "sv_dlCacheSize", "256", CVAR_ARCHIVE );
+	sv_dlRate = Cvar_Get( "sv_dlRate", "0", CVAR_ARCHIVE );
+}
+
+/*
+==================
+SV_ScheduleDownloads
+
+Splits the sv_dlRate budget for the time since the last frame evenly
+between everyone downloading.  Credit a client can't use right away
+carries over, up to half a second of its share, so clients waiting on
+acks don't lose their turn but can't hoard bandwidth either.
+==================
+*/
+void SV_ScheduleDownloads( void ) {
+	static int	lastTime;
+	int			i, count, elapsed, quantum, limit;
+	client_t	*cl;
+
+	elapsed = svs.time - lastTime;
+	lastTime = svs.time;
+
+	if ( sv_dlRate->integer <= 0 ) {
+		return;
+	}
+	if ( elapsed <= 0 ) {
+		return;
+	}
+	if ( elapsed > 1000 ) {
+		elapsed = 1000;
+	}
+
+	count = 0;
+	for ( i = 0, cl = svs.clients ; i < sv_maxclients->integer ; i++, cl++ ) {
+		if ( cl->state >= CS_CONNECTED && *cl->downloadName ) {
+			count++;
+		}
+	}
+	if ( !count ) {
+		return;
+	}
+
+	quantum = (int)( (float)sv_dlRate->integer * elapsed / 1000 / count );
+	limit = sv_dlRate->integer / count / 2;
+	if ( limit < MAX_DOWNLOAD_BLKSIZE ) {
+		limit = MAX_DOWNLOAD_BLKSIZE;
+	}
+
+	for ( i = 0, cl = svs.clients ; i < sv_maxclients->integer ; i++, cl++ ) {
+		if ( cl->state < CS_CONNECTED || !*cl->downloadName ) {
+			continue;
+		}
+		cl->downloadCredit += quantum;
+		if ( cl->downloadCredit > limit ) {
+			cl->downloadCredit = limit;
+		}
+	}
+}
+
+/*
+==================
+SV_OpenDownloadFile
+
+Attaches the client to a shared copy of the file, reading it in if nobody
+else is downloading it right now.  If the file won't fit in sv_dlCacheSize
+the client is left with an open handle in cl->download to stream from.
+Returns the file size, or <= 0 if it couldn't be opened.
+==================
+*/
+static int SV_OpenDownloadFile( client_t *cl ) {
+	downloadFile_t	*file;
+	int				size;
+
+	for ( file = sv_downloadFiles ; file ; file = file->next ) {
+		if ( !Q_stricmp( file->name, cl->downloadName ) ) {
+			file->refCount++;
+			cl->downloadFile = file;
+			Com_DPrintf( "clientDownload: %d : sharing \"%s\" with %d other clients\n", cl - svs.clients, file->name, file->refCount - 1 );
+			return file->size;
+		}
+	}
+
+	size = FS_SV_FOpenFileRead( cl->downloadName, &cl->download );
+	if ( size <= 0 ) {
+		return size;
+	}
+
+	if ( sv_downloadFileBytes + size > (long long)sv_dlCacheSize->integer * 1024 * 1024 ) {
+		return size;	// stream it block by block
+	}
+
+	file = (downloadFile_t *)Z_Malloc( sizeof( *file ), TAG_DOWNLOAD, qtrue );
+	file->data = (unsigned char *)Z_Malloc( size, TAG_DOWNLOAD, qfalse );
+	if ( FS_Read( file->data, size, cl->download ) != size ) {
+		// something went wrong, fall back to streaming it
+		Z_Free( file->data );
+		Z_Free( file );
+		FS_Seek( cl->download, 0, FS_SEEK_SET );
+		return size;
+	}
+	FS_FCloseFile( cl->download );
+	cl->download = 0;
+
+	Q_strncpyz( file->name, cl->downloadName, sizeof( file->name ) );
+	file->size = size;
+	file->refCount = 1;
+	file->next = sv_downloadFiles;
+	sv_downloadFiles = file;
+	sv_downloadFileBytes += size;
+
+	cl->downloadFile = file;
+	return size;
+}
+
+/*
+==================
+SV_ReleaseDownloadFile
+
+Drops the client's reference to a shared file, freeing it once
+the last downloader is done with it
+==================
+*/
+static void SV_ReleaseDownloadFile( client_t *cl ) {
+	downloadFile_t	*file, **prev;
+
+	file = cl->downloadFile;
+	cl->downloadFile = NULL;
+
+	if ( --file->refCount > 0 ) {
+		return;
+	}
+
+	for ( prev = &sv_downloadFiles ; *prev ; prev = &(*prev)->next ) {
+		if ( *prev == file ) {
+			*prev = file->next;
+			break;
+		}
+	}
+	sv_downloadFileBytes -= file->size;
+	Z_Free( file->data );
+	Z_Free( file );
+}
+
 /*
 ==================
 SV_CloseDownload
@@ -979,7 +1130,6 @@ SV_CloseDownload
 clear/free any download vars
 ==================
 */
-#ifndef _XBOX	// No downloads on Xbox
 static void SV_CloseDownload( client_t *cl ) {
 	int i;
 
@@ -990,6 +1140,15 @@ static void SV_CloseDownload( client_t *cl ) {
 	cl->download = 0;
 	*cl->downloadName = 0;
 
+	if (cl->downloadFile) {
+		// the blocks point into the shared copy
+		for (i = 0; i < MAX_DOWNLOAD_WINDOW; i++) {
+			cl->downloadBlocks[i] = NULL;
+		}
+		SV_ReleaseDownloadFile( cl );
+		return;
+	}
+
 	// Free the temporary buffer space
 	for (i = 0; i < MAX_DOWNLOAD_WINDOW; i++) {
 		if (cl->downloadBlocks[i]) {
@@ -1000,6 +1159,140 @@ static void SV_CloseDownload( client_t *cl ) {
 
 }
 
+/*
+==================
+SV_DownloadRTO
+
+Recomputes the retransmit timeout from the measured round trip
+==================
+*/
+#define	DOWNLOAD_MIN_RTO	200
+#define	DOWNLOAD_MAX_RTO	4000
+
+static void SV_DownloadRTO( client_t *cl ) {
+	cl->downloadRTO = cl->downloadSRTT + 4 * cl->downloadRTTVar;
+
+	// acks can't come back any faster than the client is sent snapshots
+	if ( cl->downloadRTO < 2 * cl->snapshotMsec ) {
+		cl->downloadRTO = 2 * cl->snapshotMsec;
+	}
+	if ( cl->downloadRTO < DOWNLOAD_MIN_RTO ) {
+		cl->downloadRTO = DOWNLOAD_MIN_RTO;
+	} else if ( cl->downloadRTO > DOWNLOAD_MAX_RTO ) {
+		cl->downloadRTO = DOWNLOAD_MAX_RTO;
+	}
+}
+
+/*
+==================
+SV_InitDownloadWindow
+
+Starts the window off half open, with the round trip estimate seeded
+from the client's ping if we have one
+==================
+*/
+static void SV_InitDownloadWindow( client_t *cl ) {
+	int		i;
+
+	for ( i = 0 ; i < MAX_DOWNLOAD_WINDOW ; i++ ) {
+		cl->downloadBlockSendTime[i] = 0;
+		cl->downloadBlockResent[i] = qfalse;
+	}
+
+	cl->downloadWindow = MAX_DOWNLOAD_WINDOW / 2;
+	if ( cl->downloadWindow < 1 ) {
+		cl->downloadWindow = 1;
+	}
+	cl->downloadWindowAcks = 0;
+	cl->downloadLossTime = 0;
+
+	// ping is 999 until the client is in the game, which is usually the case here
+	if ( cl->ping > 0 && cl->ping < 999 ) {
+		cl->downloadSRTT = cl->ping;
+		cl->downloadRTTVar = cl->ping / 2;
+		SV_DownloadRTO( cl );
+	} else {
+		cl->downloadSRTT = 0;
+		cl->downloadRTTVar = 0;
+		cl->downloadRTO = 1000;
+	}
+}
+
+/*
+==================
+SV_DownloadBlockAcked
+
+Takes a round trip sample from a block that was only sent once and opens
+the window up by one block for every window's worth of acks
+==================
+*/
+static void SV_DownloadBlockAcked( client_t *cl, int block ) {
+	int		index, rtt, delta;
+
+	index = block % MAX_DOWNLOAD_WINDOW;
+
+	if ( !cl->downloadBlockResent[index] ) {
+		rtt = svs.time - cl->downloadBlockSendTime[index];
+		if ( rtt < 0 ) {
+			rtt = 0;
+		}
+		if ( !cl->downloadSRTT ) {
+			cl->downloadSRTT = rtt > 0 ? rtt : 1;
+			cl->downloadRTTVar = rtt / 2;
+		} else {
+			delta = rtt - cl->downloadSRTT;
+			cl->downloadSRTT += delta / 8;
+			if ( cl->downloadSRTT < 1 ) {
+				cl->downloadSRTT = 1;
+			}
+			if ( delta < 0 ) {
+				delta = -delta;
+			}
+			cl->downloadRTTVar += ( delta - cl->downloadRTTVar ) / 4;
+		}
+		SV_DownloadRTO( cl );
+	}
+	cl->downloadBlockResent[index] = qfalse;
+
+	if ( ++cl->downloadWindowAcks >= cl->downloadWindow ) {
+		cl->downloadWindowAcks = 0;
+		if ( cl->downloadWindow < MAX_DOWNLOAD_WINDOW ) {
+			cl->downloadWindow++;
+		}
+	}
+}
+
+/*
+==================
+SV_DownloadBlockLost
+
+A block timed out, halve the window and back off the timeout.  Only done
+once per timeout period, since the client drops every block after a lost
+one and those will all time out right behind it.
+==================
+*/
+static void SV_DownloadBlockLost( client_t *cl, int block ) {
+	Com_DPrintf( "clientDownload: %d : block %d timed out after %d msec\n", cl - svs.clients, block, cl->downloadRTO );
+
+	cl->downloadBlockResent[block % MAX_DOWNLOAD_WINDOW] = qtrue;
+
+	if ( svs.time - cl->downloadLossTime < cl->downloadRTO ) {
+		return;
+	}
+	cl->downloadLossTime = svs.time;
+
+	cl->downloadWindow /= 2;
+	if ( cl->downloadWindow < 1 ) {
+		cl->downloadWindow = 1;
+	}
+	cl->downloadWindowAcks = 0;
+
+	cl->downloadRTO *= 2;
+	if ( cl->downloadRTO > DOWNLOAD_MAX_RTO ) {
+		cl->downloadRTO = DOWNLOAD_MAX_RTO;
+	}
+}
+
 /*
 ==================
 SV_StopDownload_f
@@ -1049,7 +1342,7 @@ void SV_NextDownload_f( client_t *cl )
 			return;
 		}
 
-		cl->downloadSendTime = svs.time;
+		SV_DownloadBlockAcked( cl, block );
 		cl->downloadClientBlock++;
 		return;
 	}
@@ -1087,13 +1380,14 @@ void SV_WriteDownloadToClient( client_t *cl , msg_t *msg )
 	int curindex;
 	int rate;
 	int blockspersnap;
+	int block;
 	int idPack, missionPack;
 	char errorMessage[1024];
 
 	if (!*cl->downloadName)
 		return;	// Nothing being downloaded
 
-	if (!cl->download) {
+	if (!cl->download && !cl->downloadFile) {
 		// We open the file here
 
 		Com_Printf( "clientDownload: %d : begining \"%s\"\n", cl - svs.clients, cl->downloadName );
@@ -1102,7 +1396,7 @@ void SV_WriteDownloadToClient( client_t *cl , msg_t *msg )
 		idPack = missionPack || FS_idPak(cl->downloadName, "base");
 
 		if ( !sv_allowDownload->integer || idPack ||
-			( cl->downloadSize = FS_SV_FOpenFileRead( cl->downloadName, &cl->download ) ) <= 0 ) {
+			( cl->downloadSize = SV_OpenDownloadFile( cl ) ) <= 0 ) {
 			// cannot auto-download file
 			if (idPack) {
 				Com_Printf("clientDownload: %d : \"%s\" cannot download id pk3 files\n", cl - svs.clients, cl->downloadName);
@@ -1141,6 +1435,8 @@ void SV_WriteDownloadToClient( client_t *cl , msg_t *msg )
 		cl->downloadCurrentBlock = cl->downloadClientBlock = cl->downloadXmitBlock = 0;
 		cl->downloadCount = 0;
 		cl->downloadEOF = qfalse;
+		cl->downloadCredit = 0;
+		SV_InitDownloadWindow( cl );
 	}
 
 	// Perform any reads that we need to
@@ -1149,6 +1445,18 @@ void SV_WriteDownloadToClient( client_t *cl , msg_t *msg )
 
 		curindex = (cl->downloadCurrentBlock % MAX_DOWNLOAD_WINDOW);
 
+		if (cl->downloadFile) {
+			// no copying, the block is just a window into the shared file
+			cl->downloadBlocks[curindex] = cl->downloadFile->data + cl->downloadCount;
+			cl->downloadBlockSize[curindex] = cl->downloadSize - cl->downloadCount;
+			if (cl->downloadBlockSize[curindex] > MAX_DOWNLOAD_BLKSIZE)
+				cl->downloadBlockSize[curindex] = MAX_DOWNLOAD_BLKSIZE;
+
+			cl->downloadCount += cl->downloadBlockSize[curindex];
+			cl->downloadCurrentBlock++;
+			continue;
+		}
+
 		if (!cl->downloadBlocks[curindex])
 			cl->downloadBlocks[curindex] = (unsigned char *)Z_Malloc( MAX_DOWNLOAD_BLKSIZE, TAG_DOWNLOAD, qtrue );
 
@@ -1204,31 +1512,44 @@ void SV_WriteDownloadToClient( client_t *cl , msg_t *msg )
 
 	while (blockspersnap--) {
 
-		// Write out the next section of the file, if we have already reached our window,
-		// automatically start retransmitting
-
 		if (cl->downloadClientBlock == cl->downloadCurrentBlock)
 			return; // Nothing to transmit
 
-		if (cl->downloadXmitBlock == cl->downloadCurrentBlock) {
-			// We have transmitted the complete window, should we start resending?
+		// The snapshot is already in msg, never let a block push it into overflow
+		if (msg->cursize + MAX_DOWNLOAD_BLKSIZE + 16 > msg->maxsize)
+			return;
+
+		// Out of our share of sv_dlRate until the next frame
+		if (sv_dlRate->integer > 0 && cl->downloadCredit <= 0)
+			return;
+
+		// Resend the oldest block that has gone unacknowledged for longer than
+		// the retransmit timeout, everything still inside it is left alone
+		for (block = cl->downloadClientBlock; block < cl->downloadXmitBlock; block++) {
+			if (svs.time - cl->downloadBlockSendTime[block % MAX_DOWNLOAD_WINDOW] >= cl->downloadRTO)
+				break;
+		}
 
-			//FIXME:  This uses a hardcoded one second timeout for lost blocks
-			//the timeout should be based on client rate somehow
-			if (svs.time - cl->downloadSendTime > 1000)
-				cl->downloadXmitBlock = cl->downloadClientBlock;
-			else
+		if (block < cl->downloadXmitBlock) {
+			SV_DownloadBlockLost( cl, block );
+		} else {
+			// Nothing lost, move on to a new block if the window has room
+			if (cl->downloadXmitBlock == cl->downloadCurrentBlock ||
+				cl->downloadXmitBlock - cl->downloadClientBlock >= cl->downloadWindow)
 				return;
+
+			// It will get sent with next snap shot.  The rate will keep us in line.
+			cl->downloadXmitBlock++;
 		}
 
-		// Send current block
-		curindex = (cl->downloadXmitBlock % MAX_DOWNLOAD_WINDOW);
+		// Send the block
+		curindex = (block % MAX_DOWNLOAD_WINDOW);
 
 		MSG_WriteByte( msg, svc_download );
-		MSG_WriteShort( msg, cl->downloadXmitBlock );
+		MSG_WriteShort( msg, block );
 
 		// block zero is special, contains file size
-		if ( cl->downloadXmitBlock == 0 )
+		if ( block == 0 )
 			MSG_WriteLong( msg, cl->downloadSize );
  
 		MSG_WriteShort( msg, cl->downloadBlockSize[curindex] );
@@ -1238,13 +1559,10 @@ void SV_WriteDownloadToClient( client_t *cl , msg_t *msg )
 			MSG_WriteData( msg, cl->downloadBlocks[curindex], cl->downloadBlockSize[curindex] );
 		}
 
-		Com_DPrintf( "clientDownload: %d : writing block %d\n", cl - svs.clients, cl->downloadXmitBlock );
-
-		// Move on to the next block
-		// It will get sent with next snap shot.  The rate will keep us in line.
-		cl->downloadXmitBlock++;
+		Com_DPrintf( "clientDownload: %d : writing block %d\n", cl - svs.clients, block );
 
-		cl->downloadSendTime = svs.time;
+		cl->downloadBlockSendTime[curindex] = svs.time;
+		cl->downloadCredit -= cl->downloadBlockSize[curindex];
 	}
 }
 #endif	// Xbox	- No downloads on Xbox
@@ -1262,6 +1580,96 @@ static void SV_Disconnect_f( client_t *cl ) {
 	SV_DropClient( cl, SV_GetStringEdString("MP_SVGAME","DISCONNECTED") );
 }
 
+#ifndef _XBOX
+#define	MAX_PURE_PAKS	1024
+
+// what a pure client is expected to send, only changes with the map
+typedef struct {
+	qboolean	valid;
+	int			serverId;			// sv.serverId these were built for
+	int			checksumFeed;		// sv.checksumFeed these were built for
+	qboolean	qvmCgame;			// vm_cgame / vm_ui when these were built
+	qboolean	qvmUi;
+
+	qboolean	modulesInPak;		// cgame and ui both came out of pk3s
+	int			cgameChecksum;
+	int			uiChecksum;
+
+	int			numPaks;
+	int			paks[MAX_PURE_PAKS];	// sorted pure checksums of the loaded pk3s
+} pureChecksums_t;
+
+static pureChecksums_t	sv_pureChecksums;
+
+static int SV_CompareChecksums( const void *a, const void *b ) {
+	int		ca = *(const int *)a;
+	int		cb = *(const int *)b;
+
+	if ( ca < cb ) {
+		return -1;
+	}
+	return ca > cb;
+}
+
+/*
+=================
+SV_PureChecksums
+
+Returns the checksums a pure client has to match, working them out
+again only when the map or the module settings have changed.
+Doesn't touch the command tokenizer, the client's args are still in it.
+=================
+*/
+static const pureChecksums_t *SV_PureChecksums( void ) {
+	pureChecksums_t	*pure;
+	qboolean		qvmCgame, qvmUi;
+	const char		*s;
+
+	pure = &sv_pureChecksums;
+
+	qvmCgame = (qboolean)( Cvar_VariableValue( "vm_cgame" ) != 0 );
+	qvmUi = (qboolean)( Cvar_VariableValue( "vm_ui" ) != 0 );
+
+	if ( pure->valid && pure->serverId == sv.serverId && pure->checksumFeed == sv.checksumFeed &&
+		pure->qvmCgame == qvmCgame && pure->qvmUi == qvmUi ) {
+		return pure;
+	}
+
+	pure->valid = qtrue;
+	pure->serverId = sv.serverId;
+	pure->checksumFeed = sv.checksumFeed;
+	pure->qvmCgame = qvmCgame;
+	pure->qvmUi = qvmUi;
+
+	// we run the game, so determine which cgame and ui the client "should" be running
+	//dlls are valid too now -rww
+	pure->cgameChecksum = pure->uiChecksum = 0;
+	pure->modulesInPak = (qboolean)( FS_FileIsInPAK( qvmCgame ? "vm/cgame.qvm" : "cgamex86.dll", &pure->cgameChecksum ) == 1 );
+	if ( pure->modulesInPak ) {
+		pure->modulesInPak = (qboolean)( FS_FileIsInPAK( qvmUi ? "vm/ui.qvm" : "uix86.dll", &pure->uiChecksum ) == 1 );
+	}
+
+	// get the pure checksums of the pk3 files loaded by the server
+	pure->numPaks = 0;
+	s = FS_LoadedPakPureChecksums();
+	while ( pure->numPaks < MAX_PURE_PAKS ) {
+		while ( *s && *s <= ' ' ) {
+			s++;
+		}
+		if ( !*s ) {
+			break;
+		}
+		pure->paks[pure->numPaks++] = atoi( s );
+		while ( *s > ' ' ) {
+			s++;
+		}
+	}
+	qsort( pure->paks, pure->numPaks, sizeof( pure->paks[0] ), SV_CompareChecksums );
+
+	return pure;
+}
+#endif
+
 /*
 =================
 SV_VerifyPaks_f
@@ -1277,10 +1685,11 @@ This routine would be a bit simpler with a goto but i abstained
 */
 static void SV_VerifyPaks_f( client_t *cl ) {
 #ifndef _XBOX
-	int nChkSum1, nChkSum2, nClientPaks, nServerPaks, i, j, nCurArg;
-	int nClientChkSum[1024];
-	int nServerChkSum[1024];
-	const char *pPaks, *pArg;
+	int nChkSum1, nClientPaks, i, nCurArg;
+	int nClientChkSum[MAX_PURE_PAKS];
+	int nSortedChkSum[MAX_PURE_PAKS];
+	const pureChecksums_t *pure;
+	const char *pArg;
 	qboolean bGood = qtrue;
 
 	// if we are pure, we "expect" the client to load certain things from 
@@ -1289,30 +1698,8 @@ static void SV_VerifyPaks_f( client_t *cl ) {
 	//
 	if ( sv_pure->integer != 0 ) {
 
-		bGood = qtrue;
-		nChkSum1 = nChkSum2 = 0;
-		// we run the game, so determine which cgame and ui the client "should" be running
-		//dlls are valid too now -rww
-		if (Cvar_VariableValue( "vm_cgame" ))
-		{
-			bGood = (qboolean)(FS_FileIsInPAK("vm/cgame.qvm", &nChkSum1) == 1);
-		}
-		else
-		{
-			bGood = (qboolean)(FS_FileIsInPAK("cgamex86.dll", &nChkSum1) == 1);
-		}
-
-		if (bGood)
-		{
-			if (Cvar_VariableValue( "vm_ui" ))
-			{
-				bGood = (qboolean)(FS_FileIsInPAK("vm/ui.qvm", &nChkSum2) == 1);
-			}
-			else
-			{
-				bGood = (qboolean)(FS_FileIsInPAK("uix86.dll", &nChkSum2) == 1);
-			}
-		}
+		pure = SV_PureChecksums();
+		bGood = pure->modulesInPak;
 
 		nClientPaks = Cmd_Argc();
 
@@ -1330,13 +1717,13 @@ static void SV_VerifyPaks_f( client_t *cl ) {
 			}
 			// verify first to be the cgame checksum
 			pArg = Cmd_Argv(nCurArg++);
-			if (!pArg || *pArg == '@' || atoi(pArg) != nChkSum1 ) {
+			if (!pArg || *pArg == '@' || atoi(pArg) != pure->cgameChecksum ) {
 				bGood = qfalse;
 				break;
 			}
 			// verify the second to be the ui checksum
 			pArg = Cmd_Argv(nCurArg++);
-			if (!pArg || *pArg == '@' || atoi(pArg) != nChkSum2 ) {
+			if (!pArg || *pArg == '@' || atoi(pArg) != pure->uiChecksum ) {
 				bGood = qfalse;
 				break;
 			}
@@ -1347,7 +1734,7 @@ static void SV_VerifyPaks_f( client_t *cl ) {
 				break;
 			}
 			// store checksums since tokenization is not re-entrant
-			for (i = 0; nCurArg < nClientPaks; i++) {
+			for (i = 0; nCurArg < nClientPaks && i < MAX_PURE_PAKS; i++) {
 				nClientChkSum[i] = atoi(Cmd_Argv(nCurArg++));
 			}
 
@@ -1356,40 +1743,20 @@ static void SV_VerifyPaks_f( client_t *cl ) {
 
 			// make sure none of the client check sums are the same
 			// so the client can't send 5 the same checksums
-			for (i = 0; i < nClientPaks; i++) {
-				for (j = 0; j < nClientPaks; j++) {
-					if (i == j)
-						continue;
-					if (nClientChkSum[i] == nClientChkSum[j]) {
-						bGood = qfalse;
-						break;
-					}
-				}
-				if (bGood == qfalse)
+			memcpy( nSortedChkSum, nClientChkSum, nClientPaks * sizeof( nSortedChkSum[0] ) );
+			qsort( nSortedChkSum, nClientPaks, sizeof( nSortedChkSum[0] ), SV_CompareChecksums );
+			for (i = 1; i < nClientPaks; i++) {
+				if (nSortedChkSum[i] == nSortedChkSum[i-1]) {
+					bGood = qfalse;
 					break;
+				}
 			}
 			if (bGood == qfalse)
 				break;
 
-			// get the pure checksums of the pk3 files loaded by the server
-			pPaks = FS_LoadedPakPureChecksums();
-			Cmd_TokenizeString( pPaks );
-			nServerPaks = Cmd_Argc();
-			if (nServerPaks > 1024)
-				nServerPaks = 1024;
-
-			for (i = 0; i < nServerPaks; i++) {
-				nServerChkSum[i] = atoi(Cmd_Argv(i));
-			}
-
 			// check if the client has provided any pure checksums of pk3 files not loaded by the server
 			for (i = 0; i < nClientPaks; i++) {
-				for (j = 0; j < nServerPaks; j++) {
-					if (nClientChkSum[i] == nServerChkSum[j]) {
-						break;
-					}
-				}
-				if (j >= nServerPaks) {
+				if (!bsearch(&nClientChkSum[i], pure->paks, pure->numPaks, sizeof(pure->paks[0]), SV_CompareChecksums)) {
 					bGood = qfalse;
 					break;
 				}
@@ -1450,6 +1817,7 @@ void SV_UserinfoChanged( client_t *cl ) {
 
 	// name for C code
 	Q_strncpyz( cl->name, Info_ValueForKey (cl->userinfo, "name"), sizeof(cl->name) );
+	SV_InvalidateQueryCache();
 
 	// rate command
 
@@ -12,6 +12,8 @@
 #include "server.h"
 #include "navigator.h"
 
+#include <chrono>
+
 botlib_export_t	*botlib_export;
 
 extern CMiniHeap *G2VertSpaceServer;
@@ -182,6 +184,100 @@ const char *SV_SetActiveSubBSP(int index)
 	return NULL;
 }
 
+/*
+===============================================================================
+
+PVS POINT CACHE
+
+Which leaf, cluster and area a point is in only depends on the world BSP,
+so the lookups are kept for the map in a direct mapped table keyed on the
+exact coordinates.  Things that stand still or get checked against many
+others pay for the BSP descent once.  Area connections change with doors
+and are always asked fresh.
+
+===============================================================================
+*/
+
+#define	PVS_CACHE_SIZE		4096	// power of two
+
+typedef struct {
+	int		key[3];			// the coordinates, bit for bit
+	int		generation;		// sv_pvsGeneration when filled, anything else is empty
+	int		cluster;
+	int		area;
+} pvsPoint_t;
+
+static pvsPoint_t	sv_pvsCache[PVS_CACHE_SIZE];
+static int			sv_pvsGeneration;
+static int			sv_pvsChecksumFeed;
+
+static const pvsPoint_t *SV_PVSPoint( const vec3_t p ) {
+	pvsPoint_t	*point;
+	int			key[3];
+	unsigned	hash;
+	int			leafnum;
+
+	if ( !sv_pvsGeneration || sv_pvsChecksumFeed != sv.checksumFeed ) {
+		// new map, forget everything
+		sv_pvsChecksumFeed = sv.checksumFeed;
+		if ( !++sv_pvsGeneration ) {
+			sv_pvsGeneration = 1;
+		}
+	}
+
+	Com_Memcpy( key, p, sizeof( key ) );
+	hash = (unsigned)key[0] * 73856093u ^ (unsigned)key[1] * 19349663u ^ (unsigned)key[2] * 83492791u;
+	point = &sv_pvsCache[( hash ^ ( hash >> 16 ) ) & ( PVS_CACHE_SIZE - 1 )];
+
+	if ( point->generation != sv_pvsGeneration || point->key[0] != key[0] || point->key[1] != key[1] || point->key[2] != key[2] ) {
+		leafnum = CM_PointLeafnum( p );
+		point->cluster = CM_LeafCluster( leafnum );
+		point->area = CM_LeafArea( leafnum );
+		point->key[0] = key[0];
+		point->key[1] = key[1];
+		point->key[2] = key[2];
+		point->generation = sv_pvsGeneration;
+	}
+
+	return point;
+}
+
+/*
+=================
+SV_InPVSBatch
+
+Sets visible[i] for every point that is in the PVS of origin, returns how
+many are.  Same answers as SV_inPVS or SV_inPVSIgnorePortals point by point.
+=================
+*/
+static int SV_InPVSBatch( const vec3_t origin, const vec3_t *points, int numPoints, byte *visible, qboolean ignorePortals ) {
+	const pvsPoint_t	*point;
+	int					area, i, count;
+#ifdef _XBOX
+	const byte *mask;
+#else
+	byte	*mask;
+#endif
+
+	point = SV_PVSPoint( origin );
+	area = point->area;
+	mask = CM_ClusterPVS( point->cluster );
+
+	count = 0;
+	for ( i = 0 ; i < numPoints ; i++ ) {
+		point = SV_PVSPoint( points[i] );
+		visible[i] = 1;
+		if ( mask && !( mask[point->cluster >> 3] & ( 1 << ( point->cluster & 7 ) ) ) ) {
+			visible[i] = 0;
+		} else if ( !ignorePortals && !CM_AreasConnected( area, point->area ) ) {
+			visible[i] = 0;
+		}
+		count += visible[i];
+	}
+
+	return count;
+}
+
 /*
 =================
 SV_inPVS
@@ -191,7 +287,7 @@ Also checks portalareas so that doors block sight
 */
 qboolean SV_inPVS (const vec3_t p1, const vec3_t p2)
 {
-	int		leafnum;
+	const pvsPoint_t	*point;
 	int		cluster;
 	int		area1, area2;
 #ifdef _XBOX 
@@ -200,14 +296,13 @@ qboolean SV_inPVS (const vec3_t p1, const vec3_t p2)
 	byte	*mask;
 #endif
 
-	leafnum = CM_PointLeafnum (p1);
-	cluster = CM_LeafCluster (leafnum);
-	area1 = CM_LeafArea (leafnum);
-	mask = CM_ClusterPVS (cluster);
+	point = SV_PVSPoint (p1);
+	area1 = point->area;
+	mask = CM_ClusterPVS (point->cluster);
 
-	leafnum = CM_PointLeafnum (p2);
-	cluster = CM_LeafCluster (leafnum);
-	area2 = CM_LeafArea (leafnum);
+	point = SV_PVSPoint (p2);
+	cluster = point->cluster;
+	area2 = point->area;
 	if ( mask && (!(mask[cluster>>3] & (1<<(cluster&7)) ) ) )
 		return qfalse;
 	if (!CM_AreasConnected (area1, area2))
@@ -225,23 +320,15 @@ Does NOT check portalareas
 */
 qboolean SV_inPVSIgnorePortals( const vec3_t p1, const vec3_t p2)
 {
-	int		leafnum;
 	int		cluster;
-	int		area1, area2;
 #ifdef _XBOX
 	const byte *mask;
 #else
 	byte	*mask;
 #endif
 
-	leafnum = CM_PointLeafnum (p1);
-	cluster = CM_LeafCluster (leafnum);
-	area1 = CM_LeafArea (leafnum);
-	mask = CM_ClusterPVS (cluster);
-
-	leafnum = CM_PointLeafnum (p2);
-	cluster = CM_LeafCluster (leafnum);
-	area2 = CM_LeafArea (leafnum);
+	mask = CM_ClusterPVS (SV_PVSPoint (p1)->cluster);
+	cluster = SV_PVSPoint (p2)->cluster;
 
 	if ( mask && (!(mask[cluster>>3] & (1<<(cluster&7)) ) ) )
 		return qfalse;
@@ -280,9 +367,13 @@ qboolean	SV_EntityContact( const vec3_t mins, const vec3_t maxs, const sharedEnt
 	origin = gEnt->r.currentOrigin;
 	angles = gEnt->r.currentAngles;
 
-	ch = SV_ClipHandleForEntity( gEnt );
-	CM_TransformedBoxTrace ( &trace, vec3_origin, vec3_origin, mins, maxs,
-		ch, -1, origin, angles, capsule );
+	{
+		collisionLock_t	lock;
+
+		ch = SV_ClipHandleForEntity( gEnt );
+		CM_TransformedBoxTrace ( &trace, vec3_origin, vec3_origin, mins, maxs,
+			ch, -1, origin, angles, capsule );
+	}
 
 	return (qboolean)trace.startsolid;
 }
@@ -317,36 +408,234 @@ void SV_LocateGameData( sharedEntity_t *gEnts, int numGEntities, int sizeofGEnti
 	sv.gameClientSize = sizeofGameClient;
 }
 
+/*
+===============================================================================
+
+ENTITY TOKENS
+
+The entity string is run through COM_Parse once per map and the tokens are
+kept, so spawning and every map_restart after it hand them out by index.
+The parse point in sv stays the real cursor, the cache only remembers which
+token goes with it and looks the token up again if it was moved.
+
+===============================================================================
+*/
+
+typedef struct {
+	const char	*source;		// entity string the tokens came from
+	int			checksumFeed;	// sv.checksumFeed when tokenized, the next map can reuse the pointer
+	int			sourceLength;
+	int			numTokens;
+	int			*tokens;		// offset of each token in text
+	int			*ends;			// offset in source just past each token
+	char		*text;			// the tokens, NUL terminated, one after another
+	int			cursor;			// next token to hand out
+	const char	*cursorPoint;	// parse point that goes with cursor
+} entityTokens_t;
+
+static entityTokens_t	sv_entityTokens[2];		// the map's entity string and the active sub-BSP's
+
+static void SV_ClearEntityTokens( void ) {
+	int		i;
+
+	for ( i = 0 ; i < 2 ; i++ ) {
+		if ( sv_entityTokens[i].tokens ) {
+			Z_Free( sv_entityTokens[i].tokens );
+		}
+		Com_Memset( &sv_entityTokens[i], 0, sizeof( sv_entityTokens[i] ) );
+	}
+}
+
+/*
+===============
+SV_EntityTokens
+
+Returns the tokens for source, tokenizing it first if it is new
+===============
+*/
+static entityTokens_t *SV_EntityTokens( int which, const char *source ) {
+	entityTokens_t	*et;
+	const char		*p, *s;
+	int				numTokens, textSize, len;
+
+	et = &sv_entityTokens[which];
+	if ( et->tokens && et->source == source && et->checksumFeed == sv.checksumFeed ) {
+		return et;
+	}
+
+	if ( et->tokens ) {
+		Z_Free( et->tokens );
+	}
+	Com_Memset( et, 0, sizeof( *et ) );
+	if ( !source ) {
+		return NULL;
+	}
+
+	// size it first, then keep exactly what COM_Parse gives
+	numTokens = textSize = 0;
+	p = source;
+	while ( 1 ) {
+		s = COM_Parse( &p );
+		if ( !p && !s[0] ) {
+			break;
+		}
+		numTokens++;
+		textSize += strlen( s ) + 1;
+	}
+
+	et->tokens = (int *)Z_Malloc( numTokens * 2 * sizeof( int ) + textSize + 1, TAG_GENERAL, qfalse );
+	et->ends = et->tokens + numTokens;
+	et->text = (char *)( et->ends + numTokens );
+
+	textSize = 0;
+	p = source;
+	while ( et->numTokens < numTokens ) {
+		s = COM_Parse( &p );
+		len = strlen( s ) + 1;
+		et->tokens[et->numTokens] = textSize;
+		et->ends[et->numTokens] = p - source;
+		Com_Memcpy( et->text + textSize, s, len );
+		textSize += len;
+		et->numTokens++;
+	}
+
+	et->source = source;
+	et->checksumFeed = sv.checksumFeed;
+	et->sourceLength = strlen( source );
+	et->cursorPoint = source;
+	return et;
+}
+
+/*
+===============
+SV_NextEntityToken
+
+Same as COM_Parse on *parsePoint, but from the tokens, NULL at the end
+===============
+*/
+static const char *SV_NextEntityToken( entityTokens_t *et, char **parsePoint ) {
+	const char	*s;
+	int			ofs, lo, hi, mid;
+
+	if ( !*parsePoint ) {
+		return NULL;
+	}
+
+	ofs = et ? *parsePoint - et->source : -1;
+	if ( ofs < 0 || ofs > et->sourceLength ) {
+		// not pointing into the string we know, parse it the old way
+		s = COM_Parse( (const char **)parsePoint );
+		if ( !*parsePoint && !s[0] ) {
+			return NULL;
+		}
+		return s;
+	}
+
+	if ( *parsePoint != et->cursorPoint ) {
+		// moved by someone else, the next token is the first one that ends past it
+		lo = 0;
+		hi = et->numTokens;
+		while ( lo < hi ) {
+			mid = ( lo + hi ) >> 1;
+			if ( et->ends[mid] <= ofs ) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+		et->cursor = lo;
+	}
+
+	if ( et->cursor >= et->numTokens ) {
+		*parsePoint = NULL;
+		et->cursorPoint = NULL;
+		return NULL;
+	}
+
+	s = et->text + et->tokens[et->cursor];
+	*parsePoint = (char *)et->source + et->ends[et->cursor];
+	et->cursorPoint = *parsePoint;
+	et->cursor++;
+	return s;
+}
+
+static const char *SV_NextGameEntityToken( void ) {
+	if ( sv.mLocalSubBSPIndex == -1 ) {
+		return SV_NextEntityToken( SV_EntityTokens( 0, CM_EntityString() ), &sv.entityParsePoint );
+	}
+	return SV_NextEntityToken( SV_EntityTokens( 1, CM_SubBSPEntityString( sv.mLocalSubBSPIndex ) ),
+		&sv.mLocalSubBSPEntityParsePoint );
+}
+
 qboolean SV_GetEntityToken( char *buffer, int bufferSize )
 {
-	char	*s;
+	const char	*s;
 
-	if (sv.mLocalSubBSPIndex == -1)
+	s = SV_NextGameEntityToken();
+	Q_strncpyz( buffer, s ? s : "", bufferSize );
+	if ( !s )
 	{
-		s = COM_Parse( (const char **)&sv.entityParsePoint );
-		Q_strncpyz( buffer, s, bufferSize );
-		if ( !sv.entityParsePoint && !s[0] ) 
-		{
-			return qfalse;
+		return qfalse;
+	}
+	return qtrue;
+}
+
+/*
+===============
+SV_GetEntityKeys
+
+Reads a whole { key value ... } block, the strings go into buffer and
+pairs gets their offsets, key then value.  Returns the number of pairs, or
+-1 if there are no more entities.
+===============
+*/
+static int SV_GetEntityKeys( char *buffer, int bufferSize, int *pairs, int maxPairs ) {
+	const char	*key, *value;
+	int			numPairs, used, keyLength, valueLength;
+
+	key = SV_NextGameEntityToken();
+	if ( !key ) {
+		return -1;
+	}
+	if ( strcmp( key, "{" ) ) {
+		Com_Error( ERR_DROP, "SV_GetEntityKeys: found %s when expecting {", key );
+	}
+
+	numPairs = 0;
+	used = 0;
+	while ( 1 ) {
+		key = SV_NextGameEntityToken();
+		if ( !key ) {
+			Com_Error( ERR_DROP, "SV_GetEntityKeys: EOF without closing brace" );
 		}
-		else
-		{
-			return qtrue;
+		if ( key[0] == '}' ) {
+			break;
 		}
-	}
-	else
-	{
-		s = COM_Parse( (const char **)&sv.mLocalSubBSPEntityParsePoint);
-		Q_strncpyz( buffer, s, bufferSize );
-		if ( !sv.mLocalSubBSPEntityParsePoint && !s[0] ) 
-		{
-			return qfalse;
+
+		value = SV_NextGameEntityToken();
+		if ( !value ) {
+			Com_Error( ERR_DROP, "SV_GetEntityKeys: EOF without closing brace" );
 		}
-		else
-		{
-			return qtrue;
+		if ( value[0] == '}' ) {
+			Com_Error( ERR_DROP, "SV_GetEntityKeys: closing brace without data" );
+		}
+
+		keyLength = strlen( key ) + 1;
+		valueLength = strlen( value ) + 1;
+		if ( numPairs == maxPairs || used + keyLength + valueLength > bufferSize ) {
+			Com_Error( ERR_DROP, "SV_GetEntityKeys: entity doesn't fit in %i pairs, %i bytes", maxPairs, bufferSize );
 		}
+
+		pairs[numPairs * 2] = used;
+		Com_Memcpy( buffer + used, key, keyLength );
+		used += keyLength;
+		pairs[numPairs * 2 + 1] = used;
+		Com_Memcpy( buffer + used, value, valueLength );
+		used += valueLength;
+		numPairs++;
 	}
+
+	return numPairs;
 }
 
 /*
@@ -431,14 +720,495 @@ sharedEntity_t *ConvertedEntity(sharedEntity_t *ent)
 
 	gLocalModifier.ghoul2 = ent->ghoul2;
 
-	return &gLocalModifier;
+	return &gLocalModifier;
+}
+
+siegePers_t sv_siegePersData = {qfalse, 0, 0};
+
+/*
+====================
+SV_GameNavSystemCalls
+
+The navigator traps, split out so the traces they run can be told apart
+====================
+*/
+static int SV_GameNavSystemCalls( int *args ) {
+	switch( args[0] ) {
+	//rww - BEGIN NPC NAV TRAPS
+	case G_NAV_INIT:
+		navigator.Init();
+		return 0;
+	case G_NAV_FREE:
+		navigator.Free();
+		return 0;
+	case G_NAV_LOAD:
+		return navigator.Load((const char *)VMA(1), args[2]);
+	case G_NAV_SAVE:
+		return navigator.Save((const char *)VMA(1), args[2]);
+	case G_NAV_ADDRAWPOINT:
+		return navigator.AddRawPoint((float *)VMA(1), args[2], args[3]);
+	case G_NAV_CALCULATEPATHS:
+		navigator.CalculatePaths((qboolean)args[1]);
+		return 0;
+	case G_NAV_HARDCONNECT:
+		navigator.HardConnect(args[1], args[2]);
+		return 0;
+	case G_NAV_SHOWNODES:
+		navigator.ShowNodes();
+		return 0;
+	case G_NAV_SHOWEDGES:
+		navigator.ShowEdges();
+		return 0;
+	case G_NAV_SHOWPATH:
+		navigator.ShowPath(args[1], args[2]);
+		return 0;
+	case G_NAV_GETNEARESTNODE:
+		return navigator.GetNearestNode((sharedEntity_t *)VMA(1), args[2], args[3], args[4]);
+	case G_NAV_GETBESTNODE:
+		return navigator.GetBestNode(args[1], args[2], args[3]);
+	case G_NAV_GETNODEPOSITION:
+		return navigator.GetNodePosition(args[1], (float *)VMA(2));
+	case G_NAV_GETNODENUMEDGES:
+		return navigator.GetNodeNumEdges(args[1]);
+	case G_NAV_GETNODEEDGE:
+		return navigator.GetNodeEdge(args[1], args[2]);
+	case G_NAV_GETNUMNODES:
+		return navigator.GetNumNodes();
+	case G_NAV_CONNECTED:
+		return navigator.Connected(args[1], args[2]);
+	case G_NAV_GETPATHCOST:
+		return navigator.GetPathCost(args[1], args[2]);
+	case G_NAV_GETEDGECOST:
+		return navigator.GetEdgeCost(args[1], args[2]);
+	case G_NAV_GETPROJECTEDNODE:
+		return navigator.GetProjectedNode((float *)VMA(1), args[2]);
+	case G_NAV_CHECKFAILEDNODES:
+		navigator.CheckFailedNodes((sharedEntity_t *)VMA(1));
+		return 0;
+	case G_NAV_ADDFAILEDNODE:
+		navigator.AddFailedNode((sharedEntity_t *)VMA(1), args[2]);
+		return 0;
+	case G_NAV_NODEFAILED:
+		return navigator.NodeFailed((sharedEntity_t *)VMA(1), args[2]);
+	case G_NAV_NODESARENEIGHBORS:
+		return navigator.NodesAreNeighbors(args[1], args[2]);
+	case G_NAV_CLEARFAILEDEDGE:
+		navigator.ClearFailedEdge((failedEdge_t *)VMA(1));
+		return 0;
+	case G_NAV_CLEARALLFAILEDEDGES:
+		navigator.ClearAllFailedEdges();
+		return 0;
+	case G_NAV_EDGEFAILED:
+		return navigator.EdgeFailed(args[1], args[2]);
+	case G_NAV_ADDFAILEDEDGE:
+		navigator.AddFailedEdge(args[1], args[2], args[3]);
+		return 0;
+	case G_NAV_CHECKFAILEDEDGE:
+		return navigator.CheckFailedEdge((failedEdge_t *)VMA(1));
+	case G_NAV_CHECKALLFAILEDEDGES:
+		navigator.CheckAllFailedEdges();
+		return 0;
+	case G_NAV_ROUTEBLOCKED:
+		return navigator.RouteBlocked(args[1], args[2], args[3], args[4]);
+	case G_NAV_GETBESTNODEALTROUTE:
+		return navigator.GetBestNodeAltRoute(args[1], args[2], (int *)VMA(3), args[4]);
+	case G_NAV_GETBESTNODEALT2:
+		return navigator.GetBestNodeAltRoute(args[1], args[2], args[3]);
+	case G_NAV_GETBESTPATHBETWEENENTS:
+		return navigator.GetBestPathBetweenEnts((sharedEntity_t *)VMA(1), (sharedEntity_t *)VMA(2), args[3]);
+	case G_NAV_GETNODERADIUS:
+		return navigator.GetNodeRadius(args[1]);
+	case G_NAV_CHECKBLOCKEDEDGES:
+		navigator.CheckBlockedEdges();
+		return 0;
+	case G_NAV_CLEARCHECKEDNODES:
+		navigator.ClearCheckedNodes();
+		return 0;
+	case G_NAV_CHECKEDNODE:
+		return navigator.CheckedNode(args[1], args[2]);
+	case G_NAV_SETCHECKEDNODE:
+		navigator.SetCheckedNode(args[1], args[2], args[3]);
+	case G_NAV_FLAGALLNODES:
+		navigator.FlagAllNodes(args[1]);
+	case G_NAV_GETPATHSCALCULATED:
+		return navigator.pathsCalculated;
+	case G_NAV_SETPATHSCALCULATED:
+		navigator.pathsCalculated = (qboolean)args[1];
+		return 0;
+	//rww - END NPC NAV TRAPS
+
+	default:
+		Com_Error( ERR_DROP, "Bad game system trap: %i", args[0] );
+	}
+	return -1;
+}
+
+/*
+===============================================================================
+
+NATIVE IMPORT TABLE
+
+The traces keep the same statistics attribution the syscalls give them,
+everything else points straight at the server function.
+
+===============================================================================
+*/
+
+static void SV_GameImport_Trace( trace_t *results, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int passEntityNum, int contentmask, int traceFlags, int useLod ) {
+	traceSource_t	oldSource;
+
+	oldSource = SV_SetTraceSource( TRACESRC_G_TRACE );
+	SV_Trace( results, start, mins, maxs, end, passEntityNum, contentmask, /*int capsule*/ qfalse, /*traceFlags*/0, useLod );
+	SV_SetTraceSource( oldSource );
+}
+
+static void SV_GameImport_G2Trace( trace_t *results, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int passEntityNum, int contentmask, int traceFlags, int useLod ) {
+	traceSource_t	oldSource;
+
+	oldSource = SV_SetTraceSource( TRACESRC_G_G2TRACE );
+	SV_Trace( results, start, mins, maxs, end, passEntityNum, contentmask, /*int capsule*/ qfalse, traceFlags, useLod );
+	SV_SetTraceSource( oldSource );
+}
+
+static void SV_GameImport_TraceCapsule( trace_t *results, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int passEntityNum, int contentmask, int traceFlags, int useLod ) {
+	traceSource_t	oldSource;
+
+	oldSource = SV_SetTraceSource( TRACESRC_G_TRACECAPSULE );
+	SV_Trace( results, start, mins, maxs, end, passEntityNum, contentmask, /*int capsule*/ qtrue, traceFlags, useLod );
+	SV_SetTraceSource( oldSource );
+}
+
+static void SV_GameImport_TraceBatch( const traceRequest_t *requests, trace_t *results, int count ) {
+	traceSource_t	oldSource;
+
+	if ( count <= 0 ) {
+		return;
+	}
+	oldSource = SV_SetTraceSource( TRACESRC_G_TRACEBATCH );
+	SV_TraceBatch( requests, results, count );
+	SV_SetTraceSource( oldSource );
+}
+
+static int SV_GameImport_PointContents( const vec3_t point, int passEntityNum ) {
+	traceSource_t	oldSource;
+	int				contents;
+
+	oldSource = SV_SetTraceSource( TRACESRC_G_POINT_CONTENTS );
+	contents = SV_PointContents( point, passEntityNum );
+	SV_SetTraceSource( oldSource );
+	return contents;
+}
+
+static int SV_GameImport_EntitiesInBox( const vec3_t mins, const vec3_t maxs, int *entityList, int maxcount ) {
+	traceSource_t	oldSource;
+	int				count;
+
+	oldSource = SV_SetTraceSource( TRACESRC_G_ENTITIES_IN_BOX );
+	count = SV_AreaEntities( mins, maxs, entityList, maxcount );
+	SV_SetTraceSource( oldSource );
+	return count;
+}
+
+/*
+====================
+SV_GameImportTable
+
+Fills in up to size bytes of the module's table and returns how many were
+filled.  Only a native module gets one, in a QVM the pointers would mean
+nothing, and that is told apart by the argument translation leaving the
+module's pointer alone.
+====================
+*/
+static int SV_GameImportTable( int *args ) {
+	gameImportTable_t	table;
+	int					size;
+
+	size = args[2];
+	if ( VMA(1) != (void *)args[1] || size <= 0 ) {
+		return 0;
+	}
+	if ( size > (int)sizeof( table ) ) {
+		size = sizeof( table );
+	}
+
+	Com_Memset( &table, 0, sizeof( table ) );
+	table.version = GAME_EXTENSIONS_VERSION;
+	table.Trace = SV_GameImport_Trace;
+	table.G2Trace = SV_GameImport_G2Trace;
+	table.TraceCapsule = SV_GameImport_TraceCapsule;
+	table.TraceBatch = SV_GameImport_TraceBatch;
+	table.PointContents = SV_GameImport_PointContents;
+	table.LinkEntity = SV_LinkEntity;
+	table.UnlinkEntity = SV_UnlinkEntity;
+	table.EntitiesInBox = SV_GameImport_EntitiesInBox;
+	table.EntityContact = SV_EntityContact;
+	table.GetUsercmd = SV_GetUsercmd;
+	table.SetConfigstring = SV_StoreConfigstring;
+	table.GetConfigstring = SV_FetchConfigstring;
+	table.SweepEntitiesInBox = SV_SweepEntitiesInBox;
+
+	Com_Memcpy( VMA(1), &table, size );
+	return size;
+}
+
+/*
+===============================================================================
+
+PRECISION TIMERS
+
+G_PRECISIONTIMER_START hands out one of a fixed pool of timers instead of
+allocating one.  The handle the module gets back carries the slot in its
+low bits and the start serial above them, so ending a timer twice or ending
+one whose slot has since been handed out again is ignored.  Every
+result is kept against the timer's name, G_EXT_PRECISIONTIMER_START names
+it, so "timers" can show how the instrumented code behaves over time.  A
+timer that is never ended only holds its slot until the pool runs dry.
+
+===============================================================================
+*/
+
+#define	MAX_PRECISION_TIMERS		256
+#define	MAX_PRECISION_TIMER_NAMES	64
+#define	PRECISION_TIMER_SAMPLES		512		// most recent results kept per name for the percentile
+#define	PRECISION_TIMER_SLOT_BITS	8		// 1 << bits == MAX_PRECISION_TIMERS
+#define	PRECISION_TIMER_SERIAL_MASK	0x7fffff	// keeps the handle a positive int
+
+typedef struct {
+	timing_c	timer;
+	int			name;			// index into sv_timerNames
+	int			started;		// sv_timerSerial at the start, 0 while the slot is free
+	int			handle;			// what SV_StartPrecisionTimer returned, 0 while the slot is free
+} precisionTimer_t;
+
+typedef struct {
+	char		name[MAX_QPATH];
+	int			count;
+	int			abandoned;		// started but still running when the slot was taken back
+	long long	total;
+	int			max;
+	int			samples[PRECISION_TIMER_SAMPLES];
+} precisionTimerName_t;
+
+static precisionTimer_t		sv_timers[MAX_PRECISION_TIMERS];
+static int					sv_timerFree[MAX_PRECISION_TIMERS];
+static int					sv_numTimerFree = -1;		// -1 until the free list is built
+static int					sv_timerSerial;
+static precisionTimerName_t	sv_timerNames[MAX_PRECISION_TIMER_NAMES];
+static int					sv_numTimerNames;
+
+static void SV_ClearPrecisionTimers( void ) {
+	int		i;
+
+	for ( i = 0 ; i < MAX_PRECISION_TIMERS ; i++ ) {
+		sv_timers[i].started = 0;
+		sv_timers[i].handle = 0;
+		sv_timerFree[i] = MAX_PRECISION_TIMERS - 1 - i;
+	}
+	sv_numTimerFree = MAX_PRECISION_TIMERS;
+}
+
+/*
+====================
+SV_PrecisionTimerName
+
+Finds or adds the aggregate for name, unnamed timers share the first one
+====================
+*/
+static int SV_PrecisionTimerName( const char *name ) {
+	int		i;
+
+	if ( !sv_numTimerNames ) {
+		Q_strncpyz( sv_timerNames[0].name, "unnamed", sizeof( sv_timerNames[0].name ) );
+		sv_numTimerNames = 1;
+	}
+	if ( !name || !name[0] ) {
+		return 0;
+	}
+
+	for ( i = 1 ; i < sv_numTimerNames ; i++ ) {
+		if ( !strcmp( sv_timerNames[i].name, name ) ) {
+			return i;
+		}
+	}
+
+	if ( sv_numTimerNames == MAX_PRECISION_TIMER_NAMES ) {
+		return 0;
+	}
+	Com_Memset( &sv_timerNames[i], 0, sizeof( sv_timerNames[i] ) );
+	Q_strncpyz( sv_timerNames[i].name, name, sizeof( sv_timerNames[i].name ) );
+	sv_numTimerNames++;
+	return i;
+}
+
+/*
+====================
+SV_StartPrecisionTimer
+
+Returns the handle for SV_EndPrecisionTimer, the start serial shifted above
+the slot number, never 0
+====================
+*/
+static int SV_StartPrecisionTimer( const char *name ) {
+	precisionTimer_t	*timer;
+	int					i, slot, serial;
+
+	if ( sv_numTimerFree < 0 ) {
+		SV_ClearPrecisionTimers();
+	}
+
+	if ( !sv_numTimerFree ) {
+		// out of slots, take back the one that has been running longest
+		slot = 0;
+		for ( i = 1 ; i < MAX_PRECISION_TIMERS ; i++ ) {
+			if ( sv_timers[i].started - sv_timers[slot].started < 0 ) {
+				slot = i;
+			}
+		}
+		sv_timerNames[sv_timers[slot].name].abandoned++;
+	} else {
+		slot = sv_timerFree[--sv_numTimerFree];
+	}
+
+	timer = &sv_timers[slot];
+	timer->name = SV_PrecisionTimerName( name );
+	if ( !++sv_timerSerial ) {
+		sv_timerSerial = 1;
+	}
+	timer->started = sv_timerSerial;
+	serial = sv_timerSerial & PRECISION_TIMER_SERIAL_MASK;
+	if ( !serial ) {
+		serial = 1;
+	}
+	timer->handle = ( serial << PRECISION_TIMER_SLOT_BITS ) | slot;
+	timer->timer.Start();
+
+	return timer->handle;
+}
+
+/*
+====================
+SV_EndPrecisionTimer
+
+Handles that do not match the slot's current start, stale or already
+ended, are ignored and return 0
+====================
+*/
+static int SV_EndPrecisionTimer( int handle ) {
+	precisionTimer_t		*timer;
+	precisionTimerName_t	*name;
+	int						result, slot;
+
+	if ( handle <= 0 ) {
+		return 0;
+	}
+	slot = handle & ( MAX_PRECISION_TIMERS - 1 );
+	timer = &sv_timers[slot];
+	if ( timer->handle != handle ) {
+		return 0;
+	}
+
+	result = timer->timer.End();
+	timer->started = 0;
+	timer->handle = 0;
+	sv_timerFree[sv_numTimerFree++] = slot;
+
+	name = &sv_timerNames[timer->name];
+	name->samples[name->count % PRECISION_TIMER_SAMPLES] = result;
+	name->count++;
+	name->total += result;
+	if ( result > name->max ) {
+		name->max = result;
+	}
+
+	return result;
+}
+
+static int SV_CompareTimerSamples( const void *a, const void *b ) {
+	return *(const int *)a - *(const int *)b;
+}
+
+/*
+====================
+SV_PrecisionTimers_f
+
+timers [reset]
+====================
+*/
+void SV_PrecisionTimers_f( void ) {
+	precisionTimerName_t	*name;
+	int						samples[PRECISION_TIMER_SAMPLES];
+	int						i, numSamples, running;
+
+	if ( !Q_stricmp( Cmd_Argv( 1 ), "reset" ) ) {
+		for ( i = 0 ; i < sv_numTimerNames ; i++ ) {
+			name = &sv_timerNames[i];
+			name->count = name->abandoned = name->max = 0;
+			name->total = 0;
+		}
+		return;
+	}
+
+	running = sv_numTimerFree < 0 ? 0 : MAX_PRECISION_TIMERS - sv_numTimerFree;
+	Com_Printf( "%i of %i timers running, results in cpu ticks\n", running, MAX_PRECISION_TIMERS );
+	Com_Printf( "%-32s %9s %11s %11s %11s %9s\n", "name", "count", "mean", "p99", "max", "abandoned" );
+
+	for ( i = 0 ; i < sv_numTimerNames ; i++ ) {
+		name = &sv_timerNames[i];
+		if ( !name->count && !name->abandoned ) {
+			continue;
+		}
+
+		numSamples = name->count < PRECISION_TIMER_SAMPLES ? name->count : PRECISION_TIMER_SAMPLES;
+		Com_Memcpy( samples, name->samples, numSamples * sizeof( samples[0] ) );
+		qsort( samples, numSamples, sizeof( samples[0] ), SV_CompareTimerSamples );
+
+		Com_Printf( "%-32s %9i %11.0f %11i %11i %9i\n", name->name, name->count,
+			name->count ? (double)name->total / name->count : 0.0, numSamples ? samples[numSamples * 99 / 100] : 0,
+			name->max, name->abandoned );
+	}
+}
+
+/*
+====================
+SV_GameTrueMalloc
+
+Same contract as VM_Shifted_Alloc, the module gets the memory as an offset
+from its data segment, but it comes out of the size class pools
+====================
+*/
+static void SV_GameTrueMalloc( void **ptr, int size ) {
+	byte	*dataBase;
+
+	dataBase = (byte *)VM_ArgPtr( 1 ) - 1;
+	*ptr = (void *)( (byte *)SV_PoolAlloc( size, POOL_GAME ) - dataBase );
+}
+
+static void SV_GameTrueFree( void **ptr ) {
+	byte	*dataBase;
+
+	if ( !*ptr ) {
+		return;
+	}
+
+	dataBase = (byte *)VM_ArgPtr( 1 ) - 1;
+	SV_PoolFree( dataBase + (intptr_t)*ptr );
+	*ptr = NULL;
 }
 
-siegePers_t sv_siegePersData = {qfalse, 0, 0};
-
 qhandle_t RE_RegisterServerSkin( const char *name );
 extern float g_svCullDist;
-int SV_GameSystemCalls( int *args ) {
+static int SV_GameDispatch( int *args ) {
+	traceSource_t	oldSource;
+
+	if ( args[0] >= G_NAV_INIT && args[0] <= G_NAV_SETPATHSCALCULATED ) {
+		int		result;
+
+		oldSource = SV_SetTraceSource( TRACESRC_NAV );
+		result = SV_GameNavSystemCalls( args );
+		SV_SetTraceSource( oldSource );
+		return result;
+	}
+
 	switch( args[0] ) {
 
 	//rww - alright, DO NOT EVER add a GAME/CGAME/UI generic call without adding a trap to match, and
@@ -494,21 +1264,10 @@ int SV_GameSystemCalls( int *args ) {
 	//rww - precision timer funcs... -ALWAYS- call end after start with supplied ptr, or you'll get a nasty memory leak.
 	//not that you should be using these outside of debug anyway.. because you shouldn't be. So don't.
 	case G_PRECISIONTIMER_START:
-		{
-			void **suppliedPtr =(void **)VMA(1); //we passed in a pointer to a point
-			timing_c *newTimer = new timing_c; //create the new timer
-			*suppliedPtr = newTimer; //assign the pointer within the pointer to point at the mem addr of our new timer
-			newTimer->Start(); //start the timer
-		}
+		*(void **)VMA(1) = (void *)(intptr_t)SV_StartPrecisionTimer( NULL );	// the module only hands the handle back to END
 		return 0;
 	case G_PRECISIONTIMER_END:
-		{
-			int r;
-			timing_c *timer = (timing_c *)args[1]; //this is the pointer we assigned in start, so we can directly cast it back
-			r = timer->End(); //get the result
-			delete timer; //delete the timer since we're done with it
-			return r; //return the result
-		}
+		return SV_EndPrecisionTimer( args[1] );
 	case G_CVAR_REGISTER:
 		Cvar_Register( (vmCvar_t *)VMA(1), (const char *)VMA(2), (const char *)VMA(3), args[4] ); 
 		return 0;
@@ -562,22 +1321,42 @@ int SV_GameSystemCalls( int *args ) {
 		SV_UnlinkEntity( (sharedEntity_t *)VMA(1) );
 		return 0;
 	case G_ENTITIES_IN_BOX:
-		return SV_AreaEntities( (const float *)VMA(1), (const float *)VMA(2), (int *)VMA(3), args[4] );
+		{
+			int count;
+
+			oldSource = SV_SetTraceSource( TRACESRC_G_ENTITIES_IN_BOX );
+			count = SV_AreaEntities( (const float *)VMA(1), (const float *)VMA(2), (int *)VMA(3), args[4] );
+			SV_SetTraceSource( oldSource );
+			return count;
+		}
 	case G_ENTITY_CONTACT:
 		return SV_EntityContact( (const float *)VMA(1), (const float *)VMA(2), (const sharedEntity_t *)VMA(3), /*int capsule*/ qfalse );
 	case G_ENTITY_CONTACTCAPSULE:
 		return SV_EntityContact( (const float *)VMA(1), (const float *)VMA(2), (const sharedEntity_t *)VMA(3), /*int capsule*/ qtrue );
 	case G_TRACE:
+		oldSource = SV_SetTraceSource( TRACESRC_G_TRACE );
 		SV_Trace( (trace_t *)VMA(1), (const float *)VMA(2), (const float *)VMA(3), (const float *)VMA(4), (const float *)VMA(5), args[6], args[7], /*int capsule*/ qfalse, /*args[8]*/0, args[9] );
+		SV_SetTraceSource( oldSource );
 		return 0;
 	case G_G2TRACE:
+		oldSource = SV_SetTraceSource( TRACESRC_G_G2TRACE );
 		SV_Trace( (trace_t *)VMA(1), (const float *)VMA(2), (const float *)VMA(3), (const float *)VMA(4), (const float *)VMA(5), args[6], args[7], /*int capsule*/ qfalse, args[8], args[9] );
+		SV_SetTraceSource( oldSource );
 		return 0;
 	case G_TRACECAPSULE:
+		oldSource = SV_SetTraceSource( TRACESRC_G_TRACECAPSULE );
 		SV_Trace( (trace_t *)VMA(1), (const float *)VMA(2), (const float *)VMA(3), (const float *)VMA(4), (const float *)VMA(5), args[6], args[7], /*int capsule*/ qtrue, args[8], args[9]  );
+		SV_SetTraceSource( oldSource );
 		return 0;
 	case G_POINT_CONTENTS:
-		return SV_PointContents( (const float *)VMA(1), args[2] );
+		{
+			int contents;
+
+			oldSource = SV_SetTraceSource( TRACESRC_G_POINT_CONTENTS );
+			contents = SV_PointContents( (const float *)VMA(1), args[2] );
+			SV_SetTraceSource( oldSource );
+			return contents;
+		}
 	case G_SET_SERVER_CULL:
 		g_svCullDist = VMF(1);
 		return 0;
@@ -590,10 +1369,10 @@ int SV_GameSystemCalls( int *args ) {
 		return SV_inPVSIgnorePortals( (const float *)VMA(1), (const float *)VMA(2) );
 
 	case G_SET_CONFIGSTRING:
-		SV_SetConfigstring( args[1], (const char *)VMA(2) );
+		SV_StoreConfigstring( args[1], (const char *)VMA(2) );
 		return 0;
 	case G_GET_CONFIGSTRING:
-		SV_GetConfigstring( args[1], (char *)VMA(2), args[3] );
+		SV_FetchConfigstring( args[1], (char *)VMA(2), args[3] );
 		return 0;
 	case G_SET_USERINFO:
 		SV_SetUserinfo( args[1], (const char *)VMA(2) );
@@ -712,10 +1491,10 @@ int SV_GameSystemCalls( int *args ) {
 
 	//rww - dynamic vm memory allocation!
 	case G_TRUEMALLOC:
-		VM_Shifted_Alloc((void **)VMA(1), args[2]);
+		SV_GameTrueMalloc((void **)VMA(1), args[2]);
 		return 0;
 	case G_TRUEFREE:
-		VM_Shifted_Free((void **)VMA(1));
+		SV_GameTrueFree((void **)VMA(1));
 		return 0;
 
 	//rww - icarus traps
@@ -816,108 +1595,6 @@ int SV_GameSystemCalls( int *args ) {
 		return Q3_GetVectorVariable((const char *)VMA(1), (float *)VMA(2));
 
 
-	//rww - BEGIN NPC NAV TRAPS
-	case G_NAV_INIT:
-		navigator.Init();
-		return 0;
-	case G_NAV_FREE:
-		navigator.Free();
-		return 0;
-	case G_NAV_LOAD:
-		return navigator.Load((const char *)VMA(1), args[2]);
-	case G_NAV_SAVE:
-		return navigator.Save((const char *)VMA(1), args[2]);
-	case G_NAV_ADDRAWPOINT:
-		return navigator.AddRawPoint((float *)VMA(1), args[2], args[3]);
-	case G_NAV_CALCULATEPATHS:
-		navigator.CalculatePaths((qboolean)args[1]);
-		return 0;
-	case G_NAV_HARDCONNECT:
-		navigator.HardConnect(args[1], args[2]);
-		return 0;
-	case G_NAV_SHOWNODES:
-		navigator.ShowNodes();
-		return 0;
-	case G_NAV_SHOWEDGES:
-		navigator.ShowEdges();
-		return 0;
-	case G_NAV_SHOWPATH:
-		navigator.ShowPath(args[1], args[2]);
-		return 0;
-	case G_NAV_GETNEARESTNODE:
-		return navigator.GetNearestNode((sharedEntity_t *)VMA(1), args[2], args[3], args[4]);
-	case G_NAV_GETBESTNODE:
-		return navigator.GetBestNode(args[1], args[2], args[3]);
-	case G_NAV_GETNODEPOSITION:
-		return navigator.GetNodePosition(args[1], (float *)VMA(2));
-	case G_NAV_GETNODENUMEDGES:
-		return navigator.GetNodeNumEdges(args[1]);
-	case G_NAV_GETNODEEDGE:
-		return navigator.GetNodeEdge(args[1], args[2]);
-	case G_NAV_GETNUMNODES:
-		return navigator.GetNumNodes();
-	case G_NAV_CONNECTED:
-		return navigator.Connected(args[1], args[2]);
-	case G_NAV_GETPATHCOST:
-		return navigator.GetPathCost(args[1], args[2]);
-	case G_NAV_GETEDGECOST:
-		return navigator.GetEdgeCost(args[1], args[2]);
-	case G_NAV_GETPROJECTEDNODE:
-		return navigator.GetProjectedNode((float *)VMA(1), args[2]);
-	case G_NAV_CHECKFAILEDNODES:
-		navigator.CheckFailedNodes((sharedEntity_t *)VMA(1));
-		return 0;
-	case G_NAV_ADDFAILEDNODE:
-		navigator.AddFailedNode((sharedEntity_t *)VMA(1), args[2]);
-		return 0;
-	case G_NAV_NODEFAILED:
-		return navigator.NodeFailed((sharedEntity_t *)VMA(1), args[2]);
-	case G_NAV_NODESARENEIGHBORS:
-		return navigator.NodesAreNeighbors(args[1], args[2]);
-	case G_NAV_CLEARFAILEDEDGE:
-		navigator.ClearFailedEdge((failedEdge_t *)VMA(1));
-		return 0;
-	case G_NAV_CLEARALLFAILEDEDGES:
-		navigator.ClearAllFailedEdges();
-		return 0;
-	case G_NAV_EDGEFAILED:
-		return navigator.EdgeFailed(args[1], args[2]);
-	case G_NAV_ADDFAILEDEDGE:
-		navigator.AddFailedEdge(args[1], args[2], args[3]);
-		return 0;
-	case G_NAV_CHECKFAILEDEDGE:
-		return navigator.CheckFailedEdge((failedEdge_t *)VMA(1));
-	case G_NAV_CHECKALLFAILEDEDGES:
-		navigator.CheckAllFailedEdges();
-		return 0;
-	case G_NAV_ROUTEBLOCKED:
-		return navigator.RouteBlocked(args[1], args[2], args[3], args[4]);
-	case G_NAV_GETBESTNODEALTROUTE:
-		return navigator.GetBestNodeAltRoute(args[1], args[2], (int *)VMA(3), args[4]);
-	case G_NAV_GETBESTNODEALT2:
-		return navigator.GetBestNodeAltRoute(args[1], args[2], args[3]);
-	case G_NAV_GETBESTPATHBETWEENENTS:
-		return navigator.GetBestPathBetweenEnts((sharedEntity_t *)VMA(1), (sharedEntity_t *)VMA(2), args[3]);
-	case G_NAV_GETNODERADIUS:
-		return navigator.GetNodeRadius(args[1]);
-	case G_NAV_CHECKBLOCKEDEDGES:
-		navigator.CheckBlockedEdges();
-		return 0;
-	case G_NAV_CLEARCHECKEDNODES:
-		navigator.ClearCheckedNodes();
-		return 0;
-	case G_NAV_CHECKEDNODE:
-		return navigator.CheckedNode(args[1], args[2]);
-	case G_NAV_SETCHECKEDNODE:
-		navigator.SetCheckedNode(args[1], args[2], args[3]);
-	case G_NAV_FLAGALLNODES:
-		navigator.FlagAllNodes(args[1]);
-	case G_NAV_GETPATHSCALCULATED:
-		return navigator.pathsCalculated;
-	case G_NAV_SETPATHSCALCULATED:
-		navigator.pathsCalculated = (qboolean)args[1];
-		return 0;
-	//rww - END NPC NAV TRAPS
 
 	case G_SET_SHARED_BUFFER:
 		sv.mSharedMemory = ((char *)VMA(1));
@@ -1633,12 +2310,333 @@ int SV_GameSystemCalls( int *args ) {
 	case G_GET_ENTITY_TOKEN:
 		return SV_GetEntityToken((char *)VMA(1), args[2]);
 
+	case G_EXT_TRACEBATCH:
+		if ( args[3] > 0 ) {
+			oldSource = SV_SetTraceSource( TRACESRC_G_TRACEBATCH );
+			SV_TraceBatch( (const traceRequest_t *)VMA(1), (trace_t *)VMA(2), args[3] );
+			SV_SetTraceSource( oldSource );
+		}
+		return 0;
+	case G_EXT_ENTITYPAIRS:
+		if ( args[2] <= 0 || args[4] <= 0 ) {
+			return 0;
+		}
+		return SV_EntityPairs( (const int *)VMA(1), args[2], (int *)VMA(3), args[4] );
+	case G_EXT_IMPORTTABLE:
+		return SV_GameImportTable( args );
+	case G_EXT_PRECISIONTIMER_START:
+		*(void **)VMA(1) = (void *)(intptr_t)SV_StartPrecisionTimer( (const char *)VMA(2) );
+		return 0;
+	case G_EXT_ENTITYKEYS:
+		return SV_GetEntityKeys( (char *)VMA(1), args[2], (int *)VMA(3), args[4] );
+	case G_EXT_INPVSBATCH:
+		if ( args[3] <= 0 ) {
+			return 0;
+		}
+		return SV_InPVSBatch( (const float *)VMA(1), (const vec3_t *)VMA(2), args[3], (byte *)VMA(4), (qboolean)args[5] );
+	case G_EXT_SWEEPENTITIESINBOX:
+		return SV_SweepEntitiesInBox( (const float *)VMA(1), (const float *)VMA(2), (int *)VMA(3), args[4] );
+
 	default:
 		Com_Error( ERR_DROP, "Bad game system trap: %i", args[0] );
 	}
 	return -1;
 }
 
+/*
+===============================================================================
+
+SYSCALL PROFILE
+
+With sv_syscallProfile set every game syscall is timed against its trap
+number.  Calls are folded into per frame totals once a server frame so the
+report can show the worst frame next to the averages.  Times are inclusive,
+a trap that calls back into the game module also carries the syscalls made
+from there.
+
+===============================================================================
+*/
+
+#define	SYSPROF_TRAPS		1024	// gameImport_t numbers below this get their own slot
+#define	SYSPROF_EXT_TRAPS	64		// gameImportExt_t numbers from G_EXT_TRACEBATCH on
+#define	SYSPROF_SLOTS		( SYSPROF_TRAPS + SYSPROF_EXT_TRAPS )
+
+typedef struct {
+	int			calls;
+	long long	totalNsec;
+	long long	maxNsec;
+	long long	bytes;			// buffer or string sizes passed, for the traps that take one
+	int			frameCalls;
+	long long	frameNsec;
+	int			peakFrameCalls;
+	long long	peakFrameNsec;
+} syscallStat_t;
+
+static syscallStat_t	sv_syscallStats[SYSPROF_SLOTS];
+static int				sv_syscallTouched[SYSPROF_SLOTS];	// slots with calls in the current frame
+static int				sv_syscallNumTouched;
+static int				sv_syscallFrames;
+static int				sv_syscallNextDump;
+
+static long long SV_SyscallClock( void ) {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+static int SV_SyscallSlot( int trap ) {
+	if ( trap >= 0 && trap < SYSPROF_TRAPS ) {
+		return trap;
+	}
+	if ( trap >= G_EXT_TRACEBATCH && trap < G_EXT_TRACEBATCH + SYSPROF_EXT_TRAPS ) {
+		return SYSPROF_TRAPS + trap - G_EXT_TRACEBATCH;
+	}
+	return -1;
+}
+
+static int SV_SyscallSlotTrap( int slot ) {
+	if ( slot < SYSPROF_TRAPS ) {
+		return slot;
+	}
+	return G_EXT_TRACEBATCH + slot - SYSPROF_TRAPS;
+}
+
+static int SV_SyscallStringBytes( const char *s ) {
+	return s ? strlen( s ) + 1 : 0;
+}
+
+/*
+===============
+SV_SyscallArgBytes
+
+How much data the call moves, for the traps that take a buffer or a string
+===============
+*/
+static int SV_SyscallArgBytes( int *args ) {
+	switch( args[0] ) {
+	case G_FS_READ:
+	case G_FS_WRITE:
+		return args[2];
+	case G_GET_SERVERINFO:
+		return args[2];
+	case G_CVAR_VARIABLE_STRING_BUFFER:
+	case G_ARGV:
+	case G_GET_CONFIGSTRING:
+	case G_GET_USERINFO:
+		return args[3];
+	case G_SEND_SERVER_COMMAND:
+	case G_SET_CONFIGSTRING:
+	case G_SET_USERINFO:
+		return SV_SyscallStringBytes( (const char *)VMA(2) );
+	case G_EXT_TRACEBATCH:
+		return args[3] * ( sizeof( traceRequest_t ) + sizeof( trace_t ) );
+	default:
+		return 0;
+	}
+}
+
+/*
+===============
+SV_GameSystemCalls
+
+The game module's trap handler, profiles the call when asked to
+===============
+*/
+int SV_GameSystemCalls( int *args ) {
+	syscallStat_t	*stat;
+	long long		start, nsec;
+	int				slot, bytes, result;
+
+	if ( !sv_syscallProfile || !sv_syscallProfile->integer ) {
+		return SV_GameDispatch( args );
+	}
+
+	slot = SV_SyscallSlot( args[0] );
+	if ( slot < 0 ) {
+		return SV_GameDispatch( args );
+	}
+
+	// read the sizes first, the call may change the buffers
+	bytes = SV_SyscallArgBytes( args );
+
+	start = SV_SyscallClock();
+	result = SV_GameDispatch( args );
+	nsec = SV_SyscallClock() - start;
+
+	stat = &sv_syscallStats[slot];
+	if ( !stat->frameCalls ) {
+		sv_syscallTouched[sv_syscallNumTouched++] = slot;
+	}
+	stat->calls++;
+	stat->totalNsec += nsec;
+	if ( nsec > stat->maxNsec ) {
+		stat->maxNsec = nsec;
+	}
+	stat->bytes += bytes;
+	stat->frameCalls++;
+	stat->frameNsec += nsec;
+
+	return result;
+}
+
+static void SV_SyscallProfileReset( void ) {
+	Com_Memset( sv_syscallStats, 0, sizeof( sv_syscallStats ) );
+	sv_syscallNumTouched = 0;
+	sv_syscallFrames = 0;
+}
+
+static int SV_SyscallCompare( const void *a, const void *b ) {
+	long long	ta, tb;
+
+	ta = sv_syscallStats[*(const int *)a].totalNsec;
+	tb = sv_syscallStats[*(const int *)b].totalNsec;
+	if ( ta > tb ) {
+		return -1;
+	}
+	if ( ta < tb ) {
+		return 1;
+	}
+	return *(const int *)a - *(const int *)b;
+}
+
+/*
+===============
+SV_SyscallProfileReport
+
+Prints the busiest traps to the console, or all of them to f if it is set
+===============
+*/
+static void SV_SyscallProfileReport( fileHandle_t f, int maxLines ) {
+	int				order[SYSPROF_SLOTS];
+	syscallStat_t	*stat;
+	char			line[1024];
+	long long		total;
+	int				numOrder, i, frames;
+
+	numOrder = 0;
+	total = 0;
+	for ( i = 0 ; i < SYSPROF_SLOTS ; i++ ) {
+		if ( sv_syscallStats[i].calls ) {
+			order[numOrder++] = i;
+			total += sv_syscallStats[i].totalNsec;
+		}
+	}
+	qsort( order, numOrder, sizeof( order[0] ), SV_SyscallCompare );
+
+	frames = sv_syscallFrames ? sv_syscallFrames : 1;
+
+	Com_sprintf( line, sizeof( line ), "%i frames, %.3f msec in syscalls, %.3f msec per frame\n",
+		sv_syscallFrames, total / 1000000.0, total / 1000000.0 / frames );
+	if ( f ) {
+		FS_Write( line, strlen( line ), f );
+	} else {
+		Com_Printf( "%s", line );
+	}
+
+	Com_sprintf( line, sizeof( line ), "%5s %9s %9s %10s %6s %9s %9s %11s %11s %9s\n", "trap", "calls",
+		"per frame", "total msec", "%", "avg usec", "max usec", "peak calls", "peak usec", "avg bytes" );
+	if ( f ) {
+		FS_Write( line, strlen( line ), f );
+	} else {
+		Com_Printf( "%s", line );
+	}
+
+	if ( !f && maxLines > 0 && numOrder > maxLines ) {
+		numOrder = maxLines;
+	}
+
+	for ( i = 0 ; i < numOrder ; i++ ) {
+		stat = &sv_syscallStats[order[i]];
+		Com_sprintf( line, sizeof( line ), "%5i %9i %9.1f %10.3f %6.2f %9.2f %9.1f %11i %11.1f %9.1f\n",
+			SV_SyscallSlotTrap( order[i] ), stat->calls, (float)stat->calls / frames, stat->totalNsec / 1000000.0,
+			total ? 100.0 * stat->totalNsec / total : 0.0, stat->totalNsec / 1000.0 / stat->calls,
+			stat->maxNsec / 1000.0, stat->peakFrameCalls, stat->peakFrameNsec / 1000.0, (float)stat->bytes / stat->calls );
+		if ( f ) {
+			FS_Write( line, strlen( line ), f );
+		} else {
+			Com_Printf( "%s", line );
+		}
+	}
+}
+
+/*
+===============
+SV_SyscallProfile_f
+
+syscallprofile [reset | lines]
+===============
+*/
+void SV_SyscallProfile_f( void ) {
+	if ( !Q_stricmp( Cmd_Argv( 1 ), "reset" ) ) {
+		SV_SyscallProfileReset();
+		return;
+	}
+
+	if ( !sv_syscallProfile || !sv_syscallProfile->integer ) {
+		Com_Printf( "sv_syscallProfile is off, nothing is being measured.\n" );
+	}
+	SV_SyscallProfileReport( 0, Cmd_Argc() > 1 ? atoi( Cmd_Argv( 1 ) ) : 20 );
+}
+
+/*
+===============
+SV_SyscallProfileFrame
+
+Folds the frame's calls into the peaks, and appends the report to
+syscalls.log every sv_syscallProfileDump seconds
+===============
+*/
+void SV_SyscallProfileFrame( void ) {
+	syscallStat_t	*stat;
+	fileHandle_t	f;
+	char			*header;
+	int				i, now;
+
+	if ( !sv_syscallProfile || !sv_syscallProfile->integer ) {
+		sv_syscallNextDump = 0;
+		return;
+	}
+
+	for ( i = 0 ; i < sv_syscallNumTouched ; i++ ) {
+		stat = &sv_syscallStats[sv_syscallTouched[i]];
+		if ( stat->frameCalls > stat->peakFrameCalls ) {
+			stat->peakFrameCalls = stat->frameCalls;
+		}
+		if ( stat->frameNsec > stat->peakFrameNsec ) {
+			stat->peakFrameNsec = stat->frameNsec;
+		}
+		stat->frameCalls = 0;
+		stat->frameNsec = 0;
+	}
+	sv_syscallNumTouched = 0;
+	sv_syscallFrames++;
+
+	if ( sv_syscallProfileDump->integer <= 0 ) {
+		sv_syscallNextDump = 0;
+		return;
+	}
+
+	now = Sys_Milliseconds();
+	if ( !sv_syscallNextDump ) {
+		sv_syscallNextDump = now + sv_syscallProfileDump->integer * 1000;
+		return;
+	}
+	if ( now - sv_syscallNextDump < 0 ) {
+		return;
+	}
+	sv_syscallNextDump = now + sv_syscallProfileDump->integer * 1000;
+
+	FS_FOpenFileByMode( "syscalls.log", &f, FS_APPEND );
+	if ( !f ) {
+		Com_Printf( "Couldn't open syscalls.log for writing.\n" );
+		return;
+	}
+	header = va( "--- %s, server time %i ---\n", sv_mapname->string, svs.time );
+	FS_Write( header, strlen( header ), f );
+	SV_SyscallProfileReport( f, 0 );
+	FS_FCloseFile( f );
+
+	SV_SyscallProfileReset();
+}
+
 /*
 ===============
 SV_ShutdownGameProgs
@@ -1647,12 +2645,23 @@ Called every time a map changes
 ===============
 */
 void SV_ShutdownGameProgs( void ) {
+	// a drop from inside a trace skips the lock's release
+	SV_ReleaseCollisionLock();
+
 	if ( !gvm ) {
 		return;
 	}
 	VM_Call( gvm, GAME_SHUTDOWN, qfalse );
+
+	// the module is done, nothing will reach what it didn't free
+	SV_PoolCheckLeaks( POOL_GAME, qtrue );
+	SV_PoolCheckLeaks( POOL_BOTGAME, qtrue );
+
 	VM_Free( gvm );
 	gvm = NULL;
+
+	SV_ClearPrecisionTimers();
+	SV_ClearEntityTokens();
 }
 
 /*
@@ -1729,6 +2738,12 @@ void SV_InitGameProgs( void ) {
 		Com_Error( ERR_NEED_CD, SE_GetString("CON_TEXT_NEED_CD") ); //"Game CD not in drive" );		
 	}
 
+	sv_syscallProfile = Cvar_Get( "sv_syscallProfile", "0", 0 );
+	sv_syscallProfileDump = Cvar_Get( "sv_syscallProfileDump", "0", 0 );
+
+	// let the module know which gameImportExt_t calls it may use
+	Cvar_Get( "sv_gameExtensions", va( "%i", GAME_EXTENSIONS_VERSION ), CVAR_ROM );
+
 	// load the dll or bytecode
 	gvm = VM_Create( "jampgame", SV_GameSystemCalls, (vmInterpret_t)(int)Cvar_VariableValue( "vm_game" ) );
 	if ( !gvm ) {
@@ -1,6 +1,9 @@
 #include <jampio/common/g2/api.h>
 #include "server.h"
 
+#include <chrono>
+#include <thread>
+
 serverStatic_t	svs;				// persistant server info
 server_t		sv;					// local server
 vm_t			*gvm = NULL;				// game virtual machine // bk001212 init
@@ -15,6 +18,8 @@ cvar_t	*sv_privateClients;		// number of clients reserved for password
 cvar_t	*sv_hostname;
 #ifndef _XBOX	// No master or downloads on Xbox
 cvar_t	*sv_allowDownload;
+cvar_t	*sv_dlCacheSize;		// megabytes of shared download file contents
+cvar_t	*sv_dlRate;				// bytes / second of download data across all clients, 0 is unlimited
 cvar_t	*sv_master[MAX_MASTER_SERVERS];		// master server ip address
 #endif
 cvar_t	*sv_reconnectlimit;		// minimum seconds between connect messages
@@ -35,6 +40,16 @@ cvar_t	*sv_needpass;
 #ifdef USE_CD_KEY
 cvar_t	*sv_allowAnonymous;
 #endif
+cvar_t	*sv_queryRate;			// connectionless packets per second allowed from one address
+cvar_t	*sv_queryBurst;			// connectionless packets one address may send back to back
+cvar_t	*sv_queryGlobalRate;	// getstatus/getinfo replies per second across all addresses
+cvar_t	*sv_broadphase;			// entity sorting used by the world, 0 = uniform tree (default), 1 = loose octree
+cvar_t	*sv_g2TraceCache;		// opt-in, keep transformed ghoul2 collision data for every model, not just vehicles
+cvar_t	*sv_g2TracePrecheck;	// skip ghoul2 collision for rays that miss the model's g2radius sphere
+cvar_t	*sv_traceStats;			// time traces and entity queries per calling syscall
+cvar_t	*sv_traceStatsDump;		// seconds between appending the trace stats to tracestats.log and resetting them, 0 = never
+cvar_t	*sv_syscallProfile;		// time every game syscall per trap number
+cvar_t	*sv_syscallProfileDump;	// seconds between appending the syscall profile to syscalls.log, 0 = never
 /*
 =============================================================================
 
@@ -302,37 +317,393 @@ CONNECTIONLESS COMMANDS
 ==============================================================================
 */
 
+/*
+==============================================================================
+
+CONNECTIONLESS RATE LIMITING
+
+Every connectionless packet charges a token bucket keyed on its source
+address before anything is parsed out of it, and status queries also
+charge a server-wide budget so spoofed-source floods can't turn us into
+a reflector.  Buckets live in a small open addressed table, stale slots
+are recycled as new addresses show up.
+
+==============================================================================
+*/
+
+#define	MAX_QUERY_BUCKETS		1024		// must be a power of two
+#define	QUERY_BUCKET_PROBES		8
+#define	QUERY_BUCKET_IDLE		60000		// msec before a bucket is considered stale
+
+typedef struct {
+	unsigned int	adr;			// base address, 0 if the slot is unused
+	int				tokens;			// in thousandths of a packet
+	int				lastTime;		// Sys_Milliseconds() of the last refill
+} queryBucket_t;
+
+typedef struct {
+	queryBucket_t	buckets[MAX_QUERY_BUCKETS];
+	int				globalTokens;
+	int				globalTime;
+
+	int				droppedSource;	// rejected by a per-address bucket
+	int				droppedGlobal;	// rejected by the global query budget
+	int				recycled;		// live buckets taken over by a new address
+} queryLimit_t;
+
+static queryLimit_t	svQueryLimit;
+
 /*
 ================
-SVC_Status
+SV_InitQueryLimit
+================
+*/
+void SV_InitQueryLimit( void ) {
+	sv_queryRate = Cvar_Get( "sv_queryRate", "5", CVAR_ARCHIVE );
+	sv_queryBurst = Cvar_Get( "sv_queryBurst", "20", CVAR_ARCHIVE );
+	sv_queryGlobalRate = Cvar_Get( "sv_queryGlobalRate", "250", CVAR_ARCHIVE );
+}
 
-Responds with all the info that qplug or qspy can see about the server
-and all connected players.  Used for getting detailed information after
-the simple info query.
+/*
+================
+SV_RefillBucket
+
+Tops up a bucket for the time elapsed since it was last touched and
+takes one packet out of it if it can
 ================
 */
-void SVC_Status( netadr_t from ) {
+static qboolean SV_RefillBucket( int *tokens, int *lastTime, int time, int rate, int burst ) {
+	int		elapsed;
+
+	elapsed = time - *lastTime;
+	*lastTime = time;
+
+	if ( elapsed < 0 || elapsed > QUERY_BUCKET_IDLE ) {
+		// clock went backwards or the bucket has been idle long enough to be full
+		*tokens = burst * 1000;
+	} else {
+		*tokens += elapsed * rate;
+		if ( *tokens > burst * 1000 ) {
+			*tokens = burst * 1000;
+		}
+	}
+
+	if ( *tokens < 1000 ) {
+		return qfalse;
+	}
+	*tokens -= 1000;
+	return qtrue;
+}
+
+/*
+================
+SV_FindQueryBucket
+
+Returns the bucket for the given base address, taking over the stalest
+slot along the probe sequence if the address isn't already tracked
+================
+*/
+static queryBucket_t *SV_FindQueryBucket( unsigned int adr, int time ) {
+	queryBucket_t	*b, *oldest;
+	unsigned int	hash;
+	int				i;
+
+	hash = ( adr * 2654435761U ) >> 22;		// top 10 bits for MAX_QUERY_BUCKETS
+	oldest = NULL;
+
+	for ( i = 0 ; i < QUERY_BUCKET_PROBES ; i++ ) {
+		b = &svQueryLimit.buckets[ ( hash + i ) & ( MAX_QUERY_BUCKETS - 1 ) ];
+		if ( b->adr == adr ) {
+			return b;
+		}
+		if ( !b->adr ) {
+			if ( !oldest || oldest->adr ) {
+				oldest = b;
+			}
+			continue;
+		}
+		if ( !oldest || ( oldest->adr && b->lastTime - oldest->lastTime < 0 ) ) {
+			oldest = b;
+		}
+	}
+
+	if ( oldest->adr && time - oldest->lastTime < QUERY_BUCKET_IDLE ) {
+		svQueryLimit.recycled++;
+	}
+
+	// a new address starts out with a full bucket
+	oldest->adr = adr;
+	oldest->lastTime = time;
+	oldest->tokens = sv_queryBurst->integer * 1000;
+	return oldest;
+}
+
+/*
+================
+SV_IsStatusQuery
+
+Peeks at the raw packet to see if it is a getstatus / getinfo request,
+without reading or tokenizing it
+================
+*/
+static qboolean SV_IsStatusQuery( const msg_t *msg ) {
+	const char	*s;
+	int			len;
+
+	s = (const char *)&msg->data[4];
+	len = msg->cursize - 4;
+
+	// Cmd_TokenizeString skips leading whitespace, so do the same here
+	while ( len > 0 && (unsigned char)*s <= ' ' && *s ) {
+		s++;
+		len--;
+	}
+
+	if ( len >= 9 && !Q_stricmpn( s, "getstatus", 9 ) ) {
+		return qtrue;
+	}
+	if ( len >= 7 && !Q_stricmpn( s, "getinfo", 7 ) ) {
+		return qtrue;
+	}
+	return qfalse;
+}
+
+/*
+================
+SV_CheckQueryLimit
+
+Returns qfalse if the packet should be dropped without being looked at
+================
+*/
+static qboolean SV_CheckQueryLimit( netadr_t from, const msg_t *msg ) {
+	queryBucket_t	*b;
+	unsigned int	adr;
+	int				time;
+	int				rate, burst;
+
+	if ( from.type != NA_IP ) {
+		return qtrue;		// loopback and bots are never throttled
+	}
+
+	time = Sys_Milliseconds();
+
+	rate = sv_queryRate->integer;
+	burst = sv_queryBurst->integer;
+	if ( rate > 0 ) {
+		if ( rate > 10000 ) {
+			rate = 10000;
+		}
+		if ( burst < 1 ) {
+			burst = 1;
+		}
+
+		adr = ( from.ip[0] << 24 ) | ( from.ip[1] << 16 ) | ( from.ip[2] << 8 ) | from.ip[3];
+		if ( !adr ) {
+			adr = 1;		// 0 marks an empty slot
+		}
+
+		b = SV_FindQueryBucket( adr, time );
+		if ( !SV_RefillBucket( &b->tokens, &b->lastTime, time, rate, burst ) ) {
+			svQueryLimit.droppedSource++;
+			return qfalse;
+		}
+	}
+
+	rate = sv_queryGlobalRate->integer;
+	if ( rate > 0 && SV_IsStatusQuery( msg ) ) {
+		if ( rate > 100000 ) {
+			rate = 100000;
+		}
+		// allow a second worth of queries to pile up
+		if ( !SV_RefillBucket( &svQueryLimit.globalTokens, &svQueryLimit.globalTime, time, rate, rate ) ) {
+			svQueryLimit.droppedGlobal++;
+			return qfalse;
+		}
+	}
+
+	return qtrue;
+}
+
+/*
+================
+SV_QueryStats_f
+
+Reports how many connectionless packets the rate limiter has thrown away
+================
+*/
+void SV_QueryStats_f( void ) {
+	int		i, live, time;
+
+	if ( !Q_stricmp( Cmd_Argv( 1 ), "reset" ) ) {
+		svQueryLimit.droppedSource = 0;
+		svQueryLimit.droppedGlobal = 0;
+		svQueryLimit.recycled = 0;
+		return;
+	}
+
+	time = Sys_Milliseconds();
+	live = 0;
+	for ( i = 0 ; i < MAX_QUERY_BUCKETS ; i++ ) {
+		if ( svQueryLimit.buckets[i].adr && time - svQueryLimit.buckets[i].lastTime < QUERY_BUCKET_IDLE ) {
+			live++;
+		}
+	}
+
+	Com_Printf( "per-address drops: %i\n", svQueryLimit.droppedSource );
+	Com_Printf( "global query drops: %i\n", svQueryLimit.droppedGlobal );
+	Com_Printf( "active buckets: %i / %i (%i recycled while live)\n", live, MAX_QUERY_BUCKETS, svQueryLimit.recycled );
+}
+
+/*
+==============================================================================
+
+QUERY RESPONSE CACHE
+
+The getinfo / getstatus payloads only change when a serverinfo cvar or
+a client's state, score, ping or name changes, so they are built once
+and reused.  Validation against the client list happens at most once
+a frame, the echoed challenge is the only thing added per request.
+
+==============================================================================
+*/
+
+typedef struct {
+	qboolean	infoValid;
+	qboolean	statusValid;
+	int			checkTime;		// svs.time of the last validation pass
+	int			serverId;		// sv.serverId the payloads were built for
+
+	// what the payloads were built from
+	qboolean	connected[MAX_CLIENTS];
+	int			score[MAX_CLIENTS];
+	int			ping[MAX_CLIENTS];
+
+	char		info[MAX_INFO_STRING];			// infoResponse infostring, less the challenge
+	char		serverinfo[MAX_INFO_STRING];	// statusResponse infostring, less the challenge
+	char		players[MAX_MSGLEN];			// statusResponse player lines
+} queryCache_t;
+
+static queryCache_t	svQueryCache;
+
+/*
+================
+SV_InvalidateQueryCache
+
+Forces both query payloads to be rebuilt on the next request
+================
+*/
+void SV_InvalidateQueryCache( void ) {
+	svQueryCache.infoValid = qfalse;
+	svQueryCache.statusValid = qfalse;
+}
+
+/*
+================
+SV_ValidateQueryCache
+
+Drops whichever payloads no longer match the server state
+================
+*/
+static void SV_ValidateQueryCache( void ) {
+	int			i;
+	client_t	*cl;
+	playerState_t	*ps;
+	qboolean	connected;
+
+	if ( ( cvar_modifiedFlags & CVAR_SERVERINFO ) || svQueryCache.serverId != sv.serverId ) {
+		svQueryCache.serverId = sv.serverId;
+		SV_InvalidateQueryCache();
+	}
+
+	if ( svQueryCache.checkTime == svs.time ) {
+		return;		// already looked at the clients this frame
+	}
+	svQueryCache.checkTime = svs.time;
+
+	for ( i = 0 ; i < sv_maxclients->integer ; i++ ) {
+		cl = &svs.clients[i];
+		connected = (qboolean)( cl->state >= CS_CONNECTED );
+		if ( connected != svQueryCache.connected[i] ) {
+			SV_InvalidateQueryCache();
+			return;
+		}
+		if ( !connected || !svQueryCache.statusValid ) {
+			continue;
+		}
+		ps = SV_GameClientNum( i );
+		if ( ps->persistant[PERS_SCORE] != svQueryCache.score[i] || cl->ping != svQueryCache.ping[i] ) {
+			svQueryCache.statusValid = qfalse;
+		}
+	}
+}
+
+/*
+================
+SV_SnapshotQueryClients
+
+Remembers the client state the payloads are being built from
+================
+*/
+static void SV_SnapshotQueryClients( void ) {
+	int			i;
+	client_t	*cl;
+
+	for ( i = 0 ; i < MAX_CLIENTS ; i++ ) {
+		svQueryCache.connected[i] = qfalse;
+	}
+	for ( i = 0 ; i < sv_maxclients->integer ; i++ ) {
+		cl = &svs.clients[i];
+		if ( cl->state >= CS_CONNECTED ) {
+			svQueryCache.connected[i] = qtrue;
+			svQueryCache.score[i] = SV_GameClientNum( i )->persistant[PERS_SCORE];
+			svQueryCache.ping[i] = cl->ping;
+		}
+	}
+}
+
+/*
+================
+SV_QueryChallenge
+
+Builds the "\\challenge\\<token>" pair echoed back to the requester.
+Follows the same rules Info_SetValueForKey would apply, quietly.
+================
+*/
+static void SV_QueryChallenge( char *buffer, int size, const char *challenge, const char *infostring ) {
+	buffer[0] = 0;
+
+	if ( !challenge[0] ) {
+		return;
+	}
+	if ( strchr( challenge, '\\' ) || strchr( challenge, ';' ) || strchr( challenge, '\"' ) ) {
+		return;
+	}
+
+	Com_sprintf( buffer, size, "\\challenge\\%s", challenge );
+	if ( strlen( buffer ) + strlen( infostring ) > MAX_INFO_STRING ) {
+		buffer[0] = 0;
+	}
+}
+
+/*
+================
+SV_BuildStatusResponse
+================
+*/
+static void SV_BuildStatusResponse( void ) {
 	char	player[1024];
-	char	status[MAX_MSGLEN];
 	int		i;
 	client_t	*cl;
 	playerState_t	*ps;
 	int		statusLength;
 	int		playerLength;
-	char	infostring[MAX_INFO_STRING];
+	char	*infostring;
+	char	*status;
 
-	// ignore if we are in single player
-	/*
-	if ( Cvar_VariableValue( "g_gametype" ) == GT_SINGLE_PLAYER ) {
-		return;
-	}
-	*/
+	infostring = svQueryCache.serverinfo;
+	status = svQueryCache.players;
 
-	strcpy( infostring, Cvar_InfoString( CVAR_SERVERINFO ) );
-
-	// echo back the parameter to status. so master servers can use it as a challenge
-	// to prevent timed spoofed reply packets that add ghost servers
-	Info_SetValueForKey( infostring, "challenge", Cmd_Argv(1) );
+	Q_strncpyz( infostring, Cvar_InfoString( CVAR_SERVERINFO ), sizeof( svQueryCache.serverinfo ) );
 
 	// add "demo" to the sv_keywords if restricted
 	if ( Cvar_VariableValue( "fs_restrict" ) ) {
@@ -353,7 +724,7 @@ void SVC_Status( netadr_t from ) {
 			Com_sprintf (player, sizeof(player), "%i %i \"%s\"\n", 
 				ps->persistant[PERS_SCORE], cl->ping, cl->name);
 			playerLength = strlen(player);
-			if (statusLength + playerLength >= sizeof(status) ) {
+			if (statusLength + playerLength >= sizeof(svQueryCache.players) ) {
 				break;		// can't hold any more
 			}
 			strcpy (status + statusLength, player);
@@ -361,40 +732,51 @@ void SVC_Status( netadr_t from ) {
 		}
 	}
 
-	NET_OutOfBandPrint( NS_SERVER, from, "statusResponse\n%s\n%s", infostring, status );
+	SV_SnapshotQueryClients();
+	svQueryCache.statusValid = qtrue;
 }
 
 /*
 ================
-SVC_Info
+SVC_Status
 
-Responds with a short info message that should be enough to determine
-if a user is interested in a server to do a full status
+Responds with all the info that qplug or qspy can see about the server
+and all connected players.  Used for getting detailed information after
+the simple info query.
 ================
 */
-void SVC_Info( netadr_t from ) {
-	int		i, count, wDisable;
-	const char	*gamedir;
-	char	infostring[MAX_INFO_STRING];
+void SVC_Status( netadr_t from ) {
+	char	challenge[MAX_INFO_STRING];
 
 	// ignore if we are in single player
 	/*
-	if ( Cvar_VariableValue( "g_gametype" ) == GT_SINGLE_PLAYER || Cvar_VariableValue("ui_singlePlayerActive")) {
+	if ( Cvar_VariableValue( "g_gametype" ) == GT_SINGLE_PLAYER ) {
 		return;
 	}
 	*/
 
-#ifdef _XBOX
-	// don't send system link info if in Xbox Live
-	if (logged_on)
-		return;
-#endif
-
-	if (Cvar_VariableValue("ui_singlePlayerActive"))
-	{
-		return;
+	SV_ValidateQueryCache();
+	if ( !svQueryCache.statusValid ) {
+		SV_BuildStatusResponse();
 	}
 
+	// echo back the parameter to status. so master servers can use it as a challenge
+	// to prevent timed spoofed reply packets that add ghost servers
+	SV_QueryChallenge( challenge, sizeof( challenge ), Cmd_Argv(1), svQueryCache.serverinfo );
+
+	NET_OutOfBandPrint( NS_SERVER, from, "statusResponse\n%s%s\n%s", challenge, svQueryCache.serverinfo, svQueryCache.players );
+}
+
+/*
+================
+SV_BuildInfoResponse
+================
+*/
+static void SV_BuildInfoResponse( void ) {
+	int		i, count, wDisable;
+	const char	*gamedir;
+	char	*infostring;
+
 	// don't count privateclients
 	count = 0;
 	for ( i = sv_privateClients->integer ; i < sv_maxclients->integer ; i++ ) {
@@ -403,12 +785,9 @@ void SVC_Info( netadr_t from ) {
 		}
 	}
 
+	infostring = svQueryCache.info;
 	infostring[0] = 0;
 
-	// echo back the parameter to status. so servers can use it as a challenge
-	// to prevent timed spoofed reply packets that add ghost servers
-	Info_SetValueForKey( infostring, "challenge", Cmd_Argv(1) );
-
 	Info_SetValueForKey( infostring, "protocol", va("%i", PROTOCOL_VERSION) );
 	Info_SetValueForKey( infostring, "hostname", sv_hostname->string );
 	Info_SetValueForKey( infostring, "mapname", sv_mapname->string );
@@ -459,7 +838,348 @@ void SVC_Info( netadr_t from ) {
 	Info_SetValueForKey(infostring, "xnaddr", sxnaddr);
 #endif
 
-	NET_OutOfBandPrint( NS_SERVER, from, "infoResponse\n%s", infostring );
+	if ( !svQueryCache.statusValid ) {
+		SV_SnapshotQueryClients();
+	}
+	svQueryCache.infoValid = qtrue;
+}
+
+/*
+================
+SVC_Info
+
+Responds with a short info message that should be enough to determine
+if a user is interested in a server to do a full status
+================
+*/
+void SVC_Info( netadr_t from ) {
+	char	challenge[MAX_INFO_STRING];
+
+	// ignore if we are in single player
+	/*
+	if ( Cvar_VariableValue( "g_gametype" ) == GT_SINGLE_PLAYER || Cvar_VariableValue("ui_singlePlayerActive")) {
+		return;
+	}
+	*/
+
+#ifdef _XBOX
+	// don't send system link info if in Xbox Live
+	if (logged_on)
+		return;
+#endif
+
+	if (Cvar_VariableValue("ui_singlePlayerActive"))
+	{
+		return;
+	}
+
+	SV_ValidateQueryCache();
+	if ( !svQueryCache.infoValid ) {
+		SV_BuildInfoResponse();
+	}
+
+	// echo back the parameter to status. so servers can use it as a challenge
+	// to prevent timed spoofed reply packets that add ghost servers
+	SV_QueryChallenge( challenge, sizeof( challenge ), Cmd_Argv(1), svQueryCache.info );
+
+	// Info_SetValueForKey prepends, the challenge always ended up last
+	NET_OutOfBandPrint( NS_SERVER, from, "infoResponse\n%s%s", svQueryCache.info, challenge );
+}
+
+/*
+==============================================================================
+
+CONFIGSTRING STORE
+
+A copy of sv.configstrings packed into one arena, each distinct string
+stored once, with a bit per populated index so the gamestate doesn't have
+to look at every slot.  SV_SetConfigstring and its broadcast stay as they
+are, SV_StoreConfigstring writes through them and updates the copy.  The
+spawn code sets strings behind our back, so the copy is filled again from
+sv.configstrings whenever the serverId changes, and once more when the
+server starts running if it was filled while loading.
+
+==============================================================================
+*/
+
+#define	CS_ARENA_SIZE	0x20000
+#define	CS_HASH_SIZE	1024
+
+typedef struct {
+	qboolean	valid;
+	int			serverId;		// sv.serverId the store was filled for
+	qboolean	loading;		// filled before the spawn was done
+
+	int			strings[MAX_CONFIGSTRINGS];		// arena offset of each index's entry, 0 is the empty string
+	int			sequence[MAX_CONFIGSTRINGS];	// changeSequence when the index last changed
+	int			changeSequence;
+	unsigned	populated[( MAX_CONFIGSTRINGS + 31 ) / 32];
+	int			numPopulated;
+
+	int			hash[CS_HASH_SIZE];				// first entry of each chain, 0 ends a chain
+	int			numUnique;
+	int			used;							// bytes of arena handed out
+	char		arena[CS_ARENA_SIZE];			// entries are the next entry in the chain, then the string
+} configstringStore_t;
+
+static configstringStore_t	svConfigstrings;
+
+#define	CS_ENTRY_STRING( ofs )	( svConfigstrings.arena + ( ofs ) + sizeof( int ) )
+
+static int SV_ConfigstringHash( const char *s ) {
+	unsigned	hash;
+
+	hash = 0;
+	while ( *s ) {
+		hash = hash * 31 + (byte)*s++;
+	}
+	return hash & ( CS_HASH_SIZE - 1 );
+}
+
+/*
+================
+SV_InternConfigstring
+
+Returns the arena offset of s, adding it if it isn't there yet, or -1 if
+the arena is full
+================
+*/
+static int SV_InternConfigstring( const char *s ) {
+	configstringStore_t	*store;
+	int					hash, ofs, size;
+
+	if ( !s[0] ) {
+		return 0;
+	}
+
+	store = &svConfigstrings;
+	hash = SV_ConfigstringHash( s );
+	for ( ofs = store->hash[hash] ; ofs ; ofs = *(int *)( store->arena + ofs ) ) {
+		if ( !strcmp( CS_ENTRY_STRING( ofs ), s ) ) {
+			return ofs;
+		}
+	}
+
+	size = ( sizeof( int ) + strlen( s ) + 1 + 3 ) & ~3;
+	if ( store->used + size > CS_ARENA_SIZE ) {
+		return -1;
+	}
+
+	ofs = store->used;
+	store->used += size;
+	*(int *)( store->arena + ofs ) = store->hash[hash];
+	strcpy( CS_ENTRY_STRING( ofs ), s );
+	store->hash[hash] = ofs;
+	store->numUnique++;
+
+	return ofs;
+}
+
+static void SV_ClearConfigstringStore( void ) {
+	configstringStore_t	*store;
+
+	store = &svConfigstrings;
+	Com_Memset( store->strings, 0, sizeof( store->strings ) );
+	Com_Memset( store->populated, 0, sizeof( store->populated ) );
+	Com_Memset( store->hash, 0, sizeof( store->hash ) );
+	store->numPopulated = 0;
+	store->numUnique = 0;
+
+	// offset 0 is the empty string every unset index points at
+	*(int *)store->arena = 0;
+	*CS_ENTRY_STRING( 0 ) = 0;
+	store->used = sizeof( int ) * 2;
+}
+
+static void SV_SetStoredConfigstring( int index, int ofs ) {
+	configstringStore_t	*store;
+	unsigned			bit;
+
+	store = &svConfigstrings;
+	bit = 1u << ( index & 31 );
+	if ( ofs && !( store->populated[index >> 5] & bit ) ) {
+		store->populated[index >> 5] |= bit;
+		store->numPopulated++;
+	} else if ( !ofs && ( store->populated[index >> 5] & bit ) ) {
+		store->populated[index >> 5] &= ~bit;
+		store->numPopulated--;
+	}
+	store->strings[index] = ofs;
+	store->sequence[index] = store->changeSequence;
+}
+
+/*
+================
+SV_FillConfigstringStore
+
+Copies everything from sv.configstrings, also used to drop the strings
+nothing points at any more when the arena fills up
+================
+*/
+static void SV_FillConfigstringStore( void ) {
+	int		i, ofs;
+
+	SV_ClearConfigstringStore();
+	svConfigstrings.changeSequence++;
+
+	for ( i = 0 ; i < MAX_CONFIGSTRINGS ; i++ ) {
+		if ( !sv.configstrings[i] || !sv.configstrings[i][0] ) {
+			continue;
+		}
+		ofs = SV_InternConfigstring( sv.configstrings[i] );
+		if ( ofs < 0 ) {
+			Com_Error( ERR_DROP, "SV_FillConfigstringStore: configstrings don't fit in %i bytes", CS_ARENA_SIZE );
+		}
+		SV_SetStoredConfigstring( i, ofs );
+	}
+}
+
+/*
+================
+SV_SyncConfigstringStore
+
+Refills the store if sv.configstrings may have changed without it, returns
+qtrue if it did
+================
+*/
+static qboolean SV_SyncConfigstringStore( void ) {
+	configstringStore_t	*store;
+
+	store = &svConfigstrings;
+	if ( store->valid && store->serverId == sv.serverId && !( store->loading && sv.state == SS_GAME ) ) {
+		return qfalse;
+	}
+
+	SV_FillConfigstringStore();
+	store->valid = qtrue;
+	store->serverId = sv.serverId;
+	store->loading = (qboolean)( sv.state != SS_GAME );
+	return qtrue;
+}
+
+/*
+================
+SV_StoreConfigstring
+
+SV_SetConfigstring that keeps the store current, everything in here should
+set configstrings through it
+================
+*/
+void SV_StoreConfigstring( int index, const char *val ) {
+	int		ofs;
+
+	SV_SetConfigstring( index, val );
+
+	if ( SV_SyncConfigstringStore() ) {
+		return;		// filled from sv.configstrings, which already has it
+	}
+
+	if ( !val ) {
+		val = "";
+	}
+	if ( !strcmp( CS_ENTRY_STRING( svConfigstrings.strings[index] ), val ) ) {
+		return;
+	}
+
+	svConfigstrings.changeSequence++;
+	ofs = SV_InternConfigstring( val );
+	if ( ofs < 0 ) {
+		SV_FillConfigstringStore();
+		return;
+	}
+	SV_SetStoredConfigstring( index, ofs );
+}
+
+/*
+================
+SV_StoredConfigstring
+
+Never NULL, unset indexes are the empty string
+================
+*/
+const char *SV_StoredConfigstring( int index ) {
+	if ( index < 0 || index >= MAX_CONFIGSTRINGS ) {
+		Com_Error( ERR_DROP, "SV_StoredConfigstring: bad index %i", index );
+	}
+	SV_SyncConfigstringStore();
+	return CS_ENTRY_STRING( svConfigstrings.strings[index] );
+}
+
+/*
+================
+SV_FetchConfigstring
+
+SV_GetConfigstring from the store
+================
+*/
+void SV_FetchConfigstring( int index, char *buffer, int bufferSize ) {
+	if ( bufferSize < 1 ) {
+		Com_Error( ERR_DROP, "SV_FetchConfigstring: bufferSize == %i", bufferSize );
+	}
+	Q_strncpyz( buffer, SV_StoredConfigstring( index ), bufferSize );
+}
+
+/*
+================
+SV_NextConfigstring
+
+Returns the first populated index after index, or -1 when there are no
+more, start with -1
+================
+*/
+int SV_NextConfigstring( int index ) {
+	unsigned	bits;
+	int			word;
+
+	SV_SyncConfigstringStore();
+
+	index++;
+	if ( index >= MAX_CONFIGSTRINGS ) {
+		return -1;
+	}
+
+	word = index >> 5;
+	bits = svConfigstrings.populated[word] & ( ~0u << ( index & 31 ) );
+	while ( !bits ) {
+		if ( ++word >= ( MAX_CONFIGSTRINGS + 31 ) / 32 ) {
+			return -1;
+		}
+		bits = svConfigstrings.populated[word];
+	}
+
+	for ( index = word << 5 ; !( bits & 1 ) ; bits >>= 1 ) {
+		index++;
+	}
+	return index;
+}
+
+/*
+================
+SV_Configstrings_f
+
+csstore [list]
+================
+*/
+void SV_Configstrings_f( void ) {
+	configstringStore_t	*store;
+	int					i;
+
+	if ( sv.state == SS_DEAD ) {
+		Com_Printf( "Server is not running.\n" );
+		return;
+	}
+
+	SV_SyncConfigstringStore();
+	store = &svConfigstrings;
+
+	if ( !Q_stricmp( Cmd_Argv( 1 ), "list" ) ) {
+		for ( i = SV_NextConfigstring( -1 ) ; i >= 0 ; i = SV_NextConfigstring( i ) ) {
+			Com_Printf( "%4i %6i: %.60s\n", i, store->sequence[i], CS_ENTRY_STRING( store->strings[i] ) );
+		}
+	}
+
+	Com_Printf( "%i configstrings set, %i distinct strings, %i / %i arena bytes, change %i\n",
+		store->numPopulated, store->numUnique, store->used, CS_ARENA_SIZE, store->changeSequence );
 }
 
 /*
@@ -489,14 +1209,16 @@ void SVC_RemoteCommand( netadr_t from, msg_t *msg ) {
 	char		sv_outputbuf[SV_OUTPUTBUF_LENGTH];
 	static		unsigned int	lasttime = 0;
 
-	time = Com_Milliseconds();
-	if (time<(lasttime+500)) {
-		return;
-	}
-	lasttime = time;
-
 	if ( !strlen( sv_rconPassword->string ) ||
 		strcmp (Cmd_Argv(1), sv_rconPassword->string) ) {
+		// per-address flooding is already stopped in SV_CheckQueryLimit, this
+		// gate only slows down password guessing so it can't lock out admins
+		time = Com_Milliseconds();
+		if (time<(lasttime+500)) {
+			return;
+		}
+		lasttime = time;
+
 		valid = qfalse;
 		Com_DPrintf ("Bad rcon from %s:\n%s\n", NET_AdrToString (from), Cmd_Argv(2) );
 	} else {
@@ -540,6 +1262,11 @@ void SV_ConnectionlessPacket( netadr_t from, msg_t *msg ) {
 	char	*s;
 	const char	*c;
 
+	// throttle before spending any time on the contents
+	if ( !SV_CheckQueryLimit( from, msg ) ) {
+		return;
+	}
+
 	MSG_BeginReadingOOB( msg );
 	MSG_ReadLong( msg );		// skip the -1 marker
 
@@ -809,6 +1536,181 @@ void SV_CheckCvars( void ) {
 	}
 }
 
+/*
+==============================================================================
+
+FRAME SCHEDULING
+
+1000 / sv_fps truncates, at sv_fps 30 that ran 30.3 frames a second.  The
+frames now alternate between the two nearest whole msec lengths so sv_fps
+of them make exactly one second, svs.time still moves in whole msecs.
+
+A dedicated server sleeps in NET_Sleep, which wakes up for packets but
+only counts whole msecs, for all but the last msec before a frame is due.
+SV_Frame is called as the msec clock ticks over, so the last one is slept
+on the steady clock and the caller's wait catches the edge.  That tail
+sleep can't see the socket: a packet arriving in the last msec before a
+frame waits up to FRAME_TAIL_USEC longer to be read than it would have in
+NET_Sleep.  The socket belongs to the common code and NET_Sleep only takes
+whole msecs, so there is nothing finer to wait on from here.  How late each
+frame runs against its ideal start is kept for "framestats".
+
+==============================================================================
+*/
+
+#define	FRAME_TAIL_USEC		900		// sleep this much of the last msec, the rest is left to the caller
+#define	FRAME_BUCKETS		16		// bucket i holds lateness below 2^i usec, the last one everything else
+
+typedef struct {
+	int			fps;			// sv_fps the schedule is for
+	int			remainder;		// carried over part of a msec, in 1/fps msec
+
+	long long	deadline;		// steady clock usec the next frame should start at, 0 to resync
+	int			frames;
+	long long	lateTotal;		// usec
+	int			lateMax;
+	int			lateFrames;		// started a msec or more late
+	int			catchUp;		// extra frames run to catch up in the same SV_Frame
+	int			resyncs;		// deadline dropped after a hitch or an sv_fps change
+	int			buckets[FRAME_BUCKETS];
+} frameSchedule_t;
+
+static frameSchedule_t	svFrameSchedule;
+
+static long long SV_FrameClock( void ) {
+	return std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+/*
+==================
+SV_FrameMsec
+
+Length of the next frame, 1000 / sv_fps rounded up or down so the
+remainders add up
+==================
+*/
+static int SV_FrameMsec( void ) {
+	frameSchedule_t	*fs;
+
+	fs = &svFrameSchedule;
+	if ( fs->fps != sv_fps->integer ) {
+		fs->fps = sv_fps->integer;
+		fs->remainder = 0;
+		fs->deadline = 0;
+	}
+	return 1000 / fs->fps + ( fs->remainder + 1000 % fs->fps >= fs->fps );
+}
+
+/*
+==================
+SV_FrameStarted
+
+Called before each game frame with its length, first is qfalse for the
+frames run to catch up after the first one in the same SV_Frame
+==================
+*/
+static void SV_FrameStarted( int frameMsec, qboolean first ) {
+	frameSchedule_t	*fs;
+	long long		now;
+	int				late, bucket;
+
+	fs = &svFrameSchedule;
+	fs->remainder += 1000 % fs->fps;
+	if ( fs->remainder >= fs->fps ) {
+		fs->remainder -= fs->fps;
+	}
+
+	now = SV_FrameClock();
+	if ( !first ) {
+		fs->catchUp++;
+	} else if ( !fs->deadline || now - fs->deadline > 1000000 || fs->deadline - now > 1000000 ) {
+		// first frame, or a hitch or map load, start the schedule over from here
+		if ( fs->deadline ) {
+			fs->resyncs++;
+		}
+		fs->deadline = now;
+	} else {
+		late = now > fs->deadline ? (int)( now - fs->deadline ) : 0;
+		for ( bucket = 0 ; bucket < FRAME_BUCKETS - 1 && late >= ( 1 << bucket ) ; bucket++ ) {
+		}
+		fs->frames++;
+		fs->lateTotal += late;
+		if ( late > fs->lateMax ) {
+			fs->lateMax = late;
+		}
+		if ( late >= 1000 ) {
+			fs->lateFrames++;
+		}
+		fs->buckets[bucket]++;
+	}
+
+	fs->deadline += frameMsec * 1000;
+}
+
+/*
+==================
+SV_SleepUntilFrame
+
+msec is how long until the next frame is due.  Only the NET_Sleep part
+wakes up for packets, the last msec is a plain sleep.
+==================
+*/
+static void SV_SleepUntilFrame( int msec ) {
+	if ( msec > 1 ) {
+		// NET_Sleep returns early for packets, but can oversleep, so keep the last msec back
+		NET_Sleep( msec - 1 );
+		return;
+	}
+	// not woken by packets, see FRAME SCHEDULING
+	std::this_thread::sleep_for( std::chrono::microseconds( FRAME_TAIL_USEC ) );
+}
+
+/*
+==================
+SV_FrameStats_f
+
+framestats [reset]
+==================
+*/
+void SV_FrameStats_f( void ) {
+	frameSchedule_t	*fs;
+	char			line[1024];
+	int				i;
+
+	fs = &svFrameSchedule;
+	if ( !Q_stricmp( Cmd_Argv( 1 ), "reset" ) ) {
+		fs->frames = fs->lateMax = fs->lateFrames = fs->catchUp = fs->resyncs = 0;
+		fs->lateTotal = 0;
+		Com_Memset( fs->buckets, 0, sizeof( fs->buckets ) );
+		return;
+	}
+
+	// sv_fps is only clamped when the next frame runs, report what was scheduled
+	if ( fs->fps < 1 ) {
+		Com_Printf( "no frames scheduled yet\n" );
+	} else if ( 1000 % fs->fps ) {
+		Com_Printf( "sv_fps %i, frames of %i and %i msec\n", fs->fps, 1000 / fs->fps, 1000 / fs->fps + 1 );
+	} else {
+		Com_Printf( "sv_fps %i, frames of %i msec\n", fs->fps, 1000 / fs->fps );
+	}
+	Com_Printf( "%i frames, %.1f usec late on average, %i usec at most\n", fs->frames,
+		fs->frames ? (float)fs->lateTotal / fs->frames : 0.0f, fs->lateMax );
+	Com_Printf( "%i a msec or more late, %i run to catch up, %i resyncs\n", fs->lateFrames, fs->catchUp, fs->resyncs );
+
+	line[0] = 0;
+	for ( i = 0 ; i < FRAME_BUCKETS ; i++ ) {
+		if ( !fs->buckets[i] ) {
+			continue;
+		}
+		if ( i == FRAME_BUCKETS - 1 ) {
+			Q_strcat( line, sizeof( line ), va( " >=%i:%i", 1 << ( i - 1 ), fs->buckets[i] ) );
+		} else {
+			Q_strcat( line, sizeof( line ), va( " <%i:%i", 1 << i, fs->buckets[i] ) );
+		}
+	}
+	Com_Printf( "usec late:%s\n", line );
+}
+
 /*
 ==================
 SV_Frame
@@ -820,6 +1722,7 @@ happen before SV_Frame is called
 void SV_Frame( int msec ) {
 	int		frameMsec;
 	int		startTime;
+	qboolean	first;
 
 	// the menu kills the server with this cvar
 	if ( sv_killserver->integer ) {
@@ -841,7 +1744,7 @@ void SV_Frame( int msec ) {
 	if ( sv_fps->integer < 1 ) {
 		Cvar_Set( "sv_fps", "10" );
 	}
-	frameMsec = 1000 / sv_fps->integer ;
+	frameMsec = SV_FrameMsec();
 
 	sv.timeResidual += msec;
 
@@ -850,7 +1753,7 @@ void SV_Frame( int msec ) {
 	if ( com_dedicated->integer && sv.timeResidual < frameMsec && (!com_timescale || com_timescale->value >= 1) ) {
 		// NET_Sleep will give the OS time slices until either get a packet
 		// or time enough for a server frame has gone by
-		NET_Sleep(frameMsec - sv.timeResidual);
+		SV_SleepUntilFrame(frameMsec - sv.timeResidual);
 		return;
 	}
 
@@ -880,11 +1783,12 @@ void SV_Frame( int msec ) {
 
 	// update infostrings if anything has been changed
 	if ( cvar_modifiedFlags & CVAR_SERVERINFO ) {
-		SV_SetConfigstring( CS_SERVERINFO, Cvar_InfoString( CVAR_SERVERINFO ) );
+		SV_InvalidateQueryCache();
+		SV_StoreConfigstring( CS_SERVERINFO, Cvar_InfoString( CVAR_SERVERINFO ) );
 		cvar_modifiedFlags &= ~CVAR_SERVERINFO;
 	}
 	if ( cvar_modifiedFlags & CVAR_SYSTEMINFO ) {
-		SV_SetConfigstring( CS_SYSTEMINFO, Cvar_InfoString_Big( CVAR_SYSTEMINFO ) );
+		SV_StoreConfigstring( CS_SYSTEMINFO, Cvar_InfoString_Big( CVAR_SYSTEMINFO ) );
 		cvar_modifiedFlags &= ~CVAR_SYSTEMINFO;
 	}
 
@@ -900,12 +1804,17 @@ void SV_Frame( int msec ) {
 	if (com_dedicated->integer) SV_BotFrame( svs.time );
 
 	// run the game simulation in chunks
+	first = qtrue;
 	while ( sv.timeResidual >= frameMsec ) {
 		sv.timeResidual -= frameMsec;
 		svs.time += frameMsec;
+		SV_FrameStarted( frameMsec, first );
+		first = qfalse;
 
 		// let everything in the world think and move
 		VM_Call( gvm, GAME_RUN_FRAME, svs.time );
+
+		frameMsec = SV_FrameMsec();
 	}
 
 	//rww - RAGDOLL_BEGIN
@@ -924,6 +1833,9 @@ void SV_Frame( int msec ) {
 
 	SV_CheckCvars();
 
+	SV_TraceStatsFrame();
+	SV_SyscallProfileFrame();
+
 	// send a heartbeat to the master if needed
 #ifndef _XBOX	// No master on Xbox
 	SV_MasterHeartbeat();
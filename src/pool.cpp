@@ -0,0 +1,281 @@
+#include "server.h"
+
+/*
+===============================================================================
+
+SIZE CLASS POOLS
+
+The game module's G_TRUEMALLOC and the bot memory calls make lots of small
+allocations that come and go all the time, which fragments the zone over a
+long uptime.  Those are carved out of fixed size blocks in large slabs
+instead, one free list per size class, and the slabs stay around to be
+reused.  Anything bigger than the largest class still goes to the zone.
+
+Every live allocation is kept on a list for its owner, so a leak can be
+reported and reclaimed when the owner shuts down.  All of this runs on the
+main thread only.
+
+===============================================================================
+*/
+
+#define	POOL_SLAB_SIZE		65536
+#define	POOL_MAGIC			0x5e0f
+#define	POOL_GRANULARITY	16
+
+typedef struct poolHeader_s {
+	struct poolHeader_s	*prev, *next;	// live allocations of the same tag
+	int					size;			// as requested
+	signed char			sizeClass;		// -1 for a zone allocation
+	byte				tag;
+	unsigned short		magic;
+} poolHeader_t;
+
+// space in front of every block, kept a multiple of 8 so the memory handed out stays aligned
+#define	POOL_HEADER_SIZE	( ( sizeof( poolHeader_t ) + 7 ) & ~7 )
+
+static const int	sv_poolClassSizes[] = {
+	16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048
+};
+
+#define	POOL_NUM_CLASSES	( sizeof( sv_poolClassSizes ) / sizeof( sv_poolClassSizes[0] ) )
+#define	POOL_MAX_SMALL		2048
+
+typedef struct poolBlock_s {
+	struct poolBlock_s	*next;
+} poolBlock_t;
+
+typedef struct {
+	int			liveCount;
+	int			liveBytes;
+	int			smallBytes;		// class sized blocks held, what the slabs give up for this tag
+	int			peakBytes;
+	int			allocs;
+	int			frees;
+	poolHeader_t	live;		// sentinel of the live list
+} poolTagStats_t;
+
+static const char *sv_poolTagNames[POOL_MAX] = {
+	"game",
+	"bot game",
+	"botlib"
+};
+
+// the game's big blocks stay off TAG_VM_ALLOCATED, the vm code frees that tag wholesale
+static const memtag_t	sv_poolZoneTags[POOL_MAX] = {
+	TAG_GENERAL,
+	TAG_BOTGAME,
+	TAG_BOTLIB
+};
+
+static poolBlock_t		*sv_poolFree[POOL_NUM_CLASSES];
+static byte				sv_poolClassForSize[POOL_MAX_SMALL / POOL_GRANULARITY + 1];
+static int				sv_poolSlabs;
+static poolTagStats_t	sv_poolStats[POOL_MAX];
+static int				sv_poolStatsTime;
+static qboolean			sv_poolInitialized;
+
+static void SV_PoolInit( void ) {
+	int		i, c;
+
+	c = 0;
+	for ( i = 0 ; i <= POOL_MAX_SMALL / POOL_GRANULARITY ; i++ ) {
+		while ( sv_poolClassSizes[c] < i * POOL_GRANULARITY ) {
+			c++;
+		}
+		sv_poolClassForSize[i] = c;
+	}
+
+	for ( i = 0 ; i < POOL_MAX ; i++ ) {
+		sv_poolStats[i].live.prev = sv_poolStats[i].live.next = &sv_poolStats[i].live;
+	}
+	sv_poolStatsTime = Sys_Milliseconds();
+	sv_poolInitialized = qtrue;
+}
+
+/*
+================
+SV_PoolNewSlab
+
+Carves a fresh slab into blocks for sizeClass
+================
+*/
+static void SV_PoolNewSlab( int sizeClass ) {
+	byte		*slab;
+	poolBlock_t	*block;
+	int			blockSize, i, count;
+
+	blockSize = POOL_HEADER_SIZE + sv_poolClassSizes[sizeClass];
+	count = POOL_SLAB_SIZE / blockSize;
+
+	slab = (byte *)Z_Malloc( POOL_SLAB_SIZE, TAG_GENERAL, qfalse );
+	sv_poolSlabs++;
+
+	for ( i = count - 1 ; i >= 0 ; i-- ) {
+		block = (poolBlock_t *)( slab + i * blockSize );
+		block->next = sv_poolFree[sizeClass];
+		sv_poolFree[sizeClass] = block;
+	}
+}
+
+/*
+================
+SV_PoolAlloc
+
+Returns zeroed memory, like Z_Malloc with bZeroit set
+================
+*/
+void *SV_PoolAlloc( int size, poolTag_t tag ) {
+	poolTagStats_t	*stats;
+	poolHeader_t	*header;
+	int				sizeClass;
+
+	if ( !sv_poolInitialized ) {
+		SV_PoolInit();
+	}
+	if ( size < 0 ) {
+		Com_Error( ERR_DROP, "SV_PoolAlloc: bad size %i", size );
+	}
+
+	if ( size <= POOL_MAX_SMALL ) {
+		sizeClass = sv_poolClassForSize[( size + POOL_GRANULARITY - 1 ) / POOL_GRANULARITY];
+		if ( !sv_poolFree[sizeClass] ) {
+			SV_PoolNewSlab( sizeClass );
+		}
+		header = (poolHeader_t *)sv_poolFree[sizeClass];
+		sv_poolFree[sizeClass] = sv_poolFree[sizeClass]->next;
+		Com_Memset( (byte *)header + POOL_HEADER_SIZE, 0, sv_poolClassSizes[sizeClass] );
+	} else {
+		sizeClass = -1;
+		header = (poolHeader_t *)Z_Malloc( POOL_HEADER_SIZE + size, sv_poolZoneTags[tag], qtrue );
+	}
+
+	header->size = size;
+	header->sizeClass = sizeClass;
+	header->tag = tag;
+	header->magic = POOL_MAGIC;
+
+	stats = &sv_poolStats[tag];
+	header->next = stats->live.next;
+	header->prev = &stats->live;
+	header->next->prev = header;
+	stats->live.next = header;
+
+	stats->liveCount++;
+	stats->liveBytes += size;
+	if ( sizeClass >= 0 ) {
+		stats->smallBytes += sv_poolClassSizes[sizeClass];
+	}
+	if ( stats->liveBytes > stats->peakBytes ) {
+		stats->peakBytes = stats->liveBytes;
+	}
+	stats->allocs++;
+
+	return (byte *)header + POOL_HEADER_SIZE;
+}
+
+void SV_PoolFree( void *ptr ) {
+	poolTagStats_t	*stats;
+	poolHeader_t	*header;
+	poolBlock_t		*block;
+
+	if ( !ptr ) {
+		return;
+	}
+
+	header = (poolHeader_t *)( (byte *)ptr - POOL_HEADER_SIZE );
+	if ( header->magic != POOL_MAGIC || header->tag >= POOL_MAX ) {
+		Com_Error( ERR_FATAL, "SV_PoolFree: bad pointer or freed twice" );
+	}
+	header->magic = 0;
+
+	header->prev->next = header->next;
+	header->next->prev = header->prev;
+
+	stats = &sv_poolStats[header->tag];
+	stats->liveCount--;
+	stats->liveBytes -= header->size;
+	stats->frees++;
+
+	if ( header->sizeClass < 0 ) {
+		Z_Free( header );
+		return;
+	}
+
+	stats->smallBytes -= sv_poolClassSizes[header->sizeClass];
+	block = (poolBlock_t *)header;
+	block->next = sv_poolFree[header->sizeClass];
+	sv_poolFree[header->sizeClass] = block;
+}
+
+int SV_PoolSmallBytes( poolTag_t tag ) {
+	return sv_poolStats[tag].smallBytes;
+}
+
+/*
+================
+SV_PoolCheckLeaks
+
+Reports whatever the owner of tag left behind, and gives it back if the
+owner is gone for good
+================
+*/
+void SV_PoolCheckLeaks( poolTag_t tag, qboolean reclaim ) {
+	poolTagStats_t	*stats;
+	poolHeader_t	*header;
+	int				i;
+
+	stats = &sv_poolStats[tag];
+	if ( !sv_poolInitialized || !stats->liveCount ) {
+		return;
+	}
+
+	Com_Printf( S_COLOR_YELLOW "WARNING: %s memory leaked %i allocations, %i bytes\n", sv_poolTagNames[tag],
+		stats->liveCount, stats->liveBytes );
+	for ( i = 0, header = stats->live.next ; header != &stats->live && i < 8 ; header = header->next, i++ ) {
+		Com_DPrintf( "  %i bytes\n", header->size );
+	}
+
+	while ( reclaim && stats->live.next != &stats->live ) {
+		SV_PoolFree( (byte *)stats->live.next + POOL_HEADER_SIZE );
+	}
+}
+
+/*
+================
+SV_PoolStats_f
+
+poolstats [reset]
+================
+*/
+void SV_PoolStats_f( void ) {
+	poolTagStats_t	*stats;
+	float			seconds;
+	int				i;
+
+	if ( !sv_poolInitialized ) {
+		SV_PoolInit();
+	}
+
+	if ( !Q_stricmp( Cmd_Argv( 1 ), "reset" ) ) {
+		for ( i = 0 ; i < POOL_MAX ; i++ ) {
+			stats = &sv_poolStats[i];
+			stats->peakBytes = stats->liveBytes;
+			stats->allocs = stats->frees = 0;
+		}
+		sv_poolStatsTime = Sys_Milliseconds();
+		return;
+	}
+
+	seconds = ( Sys_Milliseconds() - sv_poolStatsTime ) / 1000.0f;
+	if ( seconds <= 0 ) {
+		seconds = 1;
+	}
+
+	Com_Printf( "%i slabs, %i KB\n", sv_poolSlabs, sv_poolSlabs * ( POOL_SLAB_SIZE / 1024 ) );
+	Com_Printf( "%-9s %8s %10s %10s %10s %10s %10s\n", "tag", "live", "live bytes", "peak bytes", "allocs", "frees", "allocs/sec" );
+	for ( i = 0 ; i < POOL_MAX ; i++ ) {
+		stats = &sv_poolStats[i];
+		Com_Printf( "%-9s %8i %10i %10i %10i %10i %10.1f\n", sv_poolTagNames[i], stats->liveCount, stats->liveBytes,
+			stats->peakBytes, stats->allocs, stats->frees, stats->allocs / seconds );
+	}
+}
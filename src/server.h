@@ -14,6 +14,9 @@
 typedef struct svEntity_s {
 	struct worldSector_s *worldSector;
 	struct svEntity_s *nextEntityInWorldSector;
+	struct svEntity_s *prevEntityInWorldSector;	// NULL when first in the sector
+	struct sectorBlock_s *worldSectorBlock;	// where the bounds mirror lives
+	int				worldSectorSlot;
 	
 	entityState_t	baseline;		// for delta compression of initial sighting
 #ifdef _XBOX
@@ -48,7 +51,7 @@ typedef struct {
 #else
 	int				snapshotCounter;	// incremented for each snapshot built
 #endif
-	int				timeResidual;		// <= 1000 / sv_frame->value
+	int				timeResidual;		// <= 1000 / sv_fps->value, rounded up
 	int				nextFrameTime;		// when time > nextFrameTime, process world
 	struct cmodel_s	*models[MAX_MODELS];
 	char			*configstrings[MAX_CONFIGSTRINGS];
@@ -108,6 +111,18 @@ typedef enum {
 } clientState_t;
 
 
+#ifndef _XBOX	// No downloads on Xbox
+// the contents of a file being downloaded, read once and
+// shared by every client fetching it at the same time
+typedef struct downloadFile_s {
+	struct downloadFile_s	*next;
+	char			name[MAX_QPATH];
+	unsigned char	*data;
+	int				size;
+	int				refCount;		// clients currently downloading it
+} downloadFile_t;
+#endif
+
 typedef struct client_s {
 	clientState_t	state;
 	char			userinfo[MAX_INFO_STRING];		// name, etc
@@ -134,15 +149,24 @@ typedef struct client_s {
 #ifndef _XBOX	// No downloads on Xbox
 	char			downloadName[MAX_QPATH]; // if not empty string, we are downloading
 	fileHandle_t	download;			// file being downloaded
+	struct downloadFile_s	*downloadFile;	// shared copy of the file, downloadBlocks point into it
  	int				downloadSize;		// total bytes (can't use EOF because of paks)
  	int				downloadCount;		// bytes sent
 	int				downloadClientBlock;	// last block we sent to the client, awaiting ack
 	int				downloadCurrentBlock;	// current block number
 	int				downloadXmitBlock;	// last block we xmited
-	unsigned char	*downloadBlocks[MAX_DOWNLOAD_WINDOW];	// the buffers for the download blocks
+	unsigned char	*downloadBlocks[MAX_DOWNLOAD_WINDOW];	// the buffers for the download blocks, owned unless downloadFile is set
 	int				downloadBlockSize[MAX_DOWNLOAD_WINDOW];
 	qboolean		downloadEOF;		// We have sent the EOF block
-	int				downloadSendTime;	// time we last got an ack from the client
+	int				downloadBlockSendTime[MAX_DOWNLOAD_WINDOW];	// svs.time each block was last transmitted
+	qboolean		downloadBlockResent[MAX_DOWNLOAD_WINDOW];	// resent blocks give no round trip sample
+	int				downloadWindow;		// blocks allowed in flight, <= MAX_DOWNLOAD_WINDOW
+	int				downloadWindowAcks;	// acks counted towards the next window increase
+	int				downloadSRTT;		// smoothed block round trip, 0 if nothing measured yet
+	int				downloadRTTVar;		// round trip variation
+	int				downloadRTO;		// msec before an unacknowledged block is presumed lost
+	int				downloadLossTime;	// svs.time the window was last cut
+	int				downloadCredit;		// bytes this client may still send under sv_dlRate
 #endif
 
 	int				deltaMessage;		// frame last client usercmd message
@@ -228,6 +252,8 @@ extern	cvar_t	*sv_zombietime;
 extern	cvar_t	*sv_rconPassword;
 extern	cvar_t	*sv_privatePassword;
 extern	cvar_t	*sv_allowDownload;
+extern	cvar_t	*sv_dlCacheSize;
+extern	cvar_t	*sv_dlRate;
 extern	cvar_t	*sv_maxclients;
 extern	cvar_t	*sv_privateClients;
 extern	cvar_t	*sv_hostname;
@@ -250,6 +276,16 @@ extern	cvar_t	*sv_needpass;
 #ifdef USE_CD_KEY
 extern	cvar_t	*sv_allowAnonymous;
 #endif
+extern	cvar_t	*sv_queryRate;
+extern	cvar_t	*sv_queryBurst;
+extern	cvar_t	*sv_queryGlobalRate;
+extern	cvar_t	*sv_broadphase;
+extern	cvar_t	*sv_g2TraceCache;
+extern	cvar_t	*sv_g2TracePrecheck;
+extern	cvar_t	*sv_traceStats;
+extern	cvar_t	*sv_traceStatsDump;
+extern	cvar_t	*sv_syscallProfile;
+extern	cvar_t	*sv_syscallProfileDump;
 
 //===========================================================
 
@@ -267,6 +303,21 @@ void SV_RemoveOperatorCommands (void);
 void SV_MasterHeartbeat (void);
 void SV_MasterShutdown (void);
 
+void SV_InitQueryLimit (void);
+void SV_QueryStats_f (void);
+void SV_InvalidateQueryCache (void);
+
+void SV_StoreConfigstring( int index, const char *val );
+// SV_SetConfigstring that also updates the configstring store, use it for every set
+
+const char *SV_StoredConfigstring( int index );
+void SV_FetchConfigstring( int index, char *buffer, int bufferSize );
+int SV_NextConfigstring( int index );
+// populated indexes in order, start with -1, returns -1 after the last one
+
+void SV_Configstrings_f( void );
+void SV_FrameStats_f( void );
+
 
 
 
@@ -305,6 +356,8 @@ void SV_ExecuteClientCommand( client_t *cl, const char *s, qboolean clientOK );
 void SV_ClientThink (client_t *cl, usercmd_t *cmd);
 
 void SV_WriteDownloadToClient( client_t *cl , msg_t *msg );
+void SV_InitDownloads( void );
+void SV_ScheduleDownloads( void );
 
 // Need to broadcast info about clients on join/leave
 #ifdef _XBOX
@@ -332,6 +385,57 @@ void SV_SendClientSnapshot( client_t *client );
 //
 // sv_game.c
 //
+
+// Server side additions to the game import table.  They are numbered well
+// clear of gameImport_t, a module should only use them when the
+// sv_gameExtensions cvar is at least the version that introduced them.
+#define	GAME_EXTENSIONS_VERSION		7
+
+// one SV_Trace worth of arguments, shared with the game module
+typedef struct {
+	vec3_t		start;
+	vec3_t		mins;
+	vec3_t		maxs;
+	vec3_t		end;
+	int			passEntityNum;
+	int			contentmask;
+	int			capsule;
+	int			traceFlags;
+	int			useLod;
+} traceRequest_t;
+
+typedef enum {
+	G_EXT_TRACEBATCH = 4096,	// ( traceRequest_t *requests, trace_t *results, int count ), version 1
+	G_EXT_ENTITYPAIRS,			// ( const int *entityNums, int numEntities, int *pairs, int maxPairs ), version 2
+	G_EXT_IMPORTTABLE,			// ( gameImportTable_t *table, int size ), version 3
+	G_EXT_PRECISIONTIMER_START,	// ( void **timer, const char *name ), version 4, ended by G_PRECISIONTIMER_END
+	G_EXT_ENTITYKEYS,			// ( char *buffer, int bufferSize, int *pairs, int maxPairs ), version 5
+	G_EXT_INPVSBATCH,			// ( const vec3_t origin, const vec3_t *points, int numPoints, byte *visible, int ignorePortals ), version 6
+	G_EXT_SWEEPENTITIESINBOX,	// ( const vec3_t mins, const vec3_t maxs, int *entityList, int maxcount ), version 7
+} gameImportExt_t;
+
+// Direct entry points for the hot traps, handed to a native game module by
+// G_EXT_IMPORTTABLE so those calls skip the syscall switch and the argument
+// translation.  The call fills in at most size bytes and returns how many it
+// filled, or 0 for a QVM.  New members only ever go on the end.
+typedef struct {
+	int			version;		// GAME_EXTENSIONS_VERSION of the server that filled it in
+
+	void		(*Trace)( trace_t *results, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int passEntityNum, int contentmask, int traceFlags, int useLod );
+	void		(*G2Trace)( trace_t *results, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int passEntityNum, int contentmask, int traceFlags, int useLod );
+	void		(*TraceCapsule)( trace_t *results, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int passEntityNum, int contentmask, int traceFlags, int useLod );
+	void		(*TraceBatch)( const traceRequest_t *requests, trace_t *results, int count );
+	int			(*PointContents)( const vec3_t point, int passEntityNum );
+	void		(*LinkEntity)( sharedEntity_t *ent );
+	void		(*UnlinkEntity)( sharedEntity_t *ent );
+	int			(*EntitiesInBox)( const vec3_t mins, const vec3_t maxs, int *entityList, int maxcount );
+	qboolean	(*EntityContact)( const vec3_t mins, const vec3_t maxs, const sharedEntity_t *ent, int capsule );
+	void		(*GetUsercmd)( int clientNum, usercmd_t *cmd );
+	void		(*SetConfigstring)( int index, const char *val );
+	void		(*GetConfigstring)( int index, char *buffer, int bufferSize );
+	int			(*SweepEntitiesInBox)( const vec3_t mins, const vec3_t maxs, int *entityList, int maxcount );	// version 7
+} gameImportTable_t;
+
 int	SV_NumForGentity( sharedEntity_t *ent );
 sharedEntity_t *SV_GentityNum( int num );
 playerState_t *SV_GameClientNum( int num );
@@ -341,6 +445,9 @@ void		SV_InitGameProgs ( void );
 void		SV_ShutdownGameProgs ( void );
 void		SV_RestartGameProgs( void );
 qboolean	SV_inPVS (const vec3_t p1, const vec3_t p2);
+void		SV_SyscallProfile_f( void );
+void		SV_PrecisionTimers_f( void );
+void		SV_SyscallProfileFrame( void );
 
 //
 // sv_bot.c
@@ -366,6 +473,9 @@ void BotImport_DebugPolygonDelete(int id);
 // high level object sorting to reduce interaction tests
 //
 
+void SV_InitWorld (void);
+// registers the world cvars, sv_broadphase is read by SV_ClearWorld
+
 void SV_ClearWorld (void);
 // called after the world model has been loaded, before linking any entities
 
@@ -385,6 +495,47 @@ clipHandle_t SV_ClipHandleForEntity( const sharedEntity_t *ent );
 
 
 void SV_SectorList_f( void );
+void SV_TraceTest_f( void );
+void SV_G2TraceStats_f( void );
+void SV_TraceStats_f( void );
+
+// who is asking for the traces and entity queries sv_traceStats measures
+typedef enum {
+	TRACESRC_OTHER,
+	TRACESRC_G_TRACE,
+	TRACESRC_G_G2TRACE,
+	TRACESRC_G_TRACECAPSULE,
+	TRACESRC_G_POINT_CONTENTS,
+	TRACESRC_G_ENTITIES_IN_BOX,
+	TRACESRC_G_TRACEBATCH,
+	TRACESRC_NAV,
+	TRACESRC_BOT,
+	TRACESRC_MAX
+} traceSource_t;
+
+traceSource_t SV_SetTraceSource( traceSource_t source );
+// attributes the calling thread's queries to source until changed again,
+// returns the previous source so nested callers can restore it
+
+void SV_TraceStatsFrame( void );
+// appends the report to tracestats.log and resets it every sv_traceStatsDump seconds
+
+void SV_LockCollision( void );
+void SV_UnlockCollision( void );
+// serializes calls into the collision model and ghoul2 code, which are not
+// reentrant, so traces can run from several threads
+
+void SV_ReleaseCollisionLock( void );
+// unlocks the collision lock if Com_Error left this thread holding it
+
+struct collisionLock_t {
+	collisionLock_t() { SV_LockCollision(); }
+	~collisionLock_t() { SV_UnlockCollision(); }
+	collisionLock_t( const collisionLock_t & ) = delete;
+	collisionLock_t &operator=( const collisionLock_t & ) = delete;
+};
+// holds the collision lock for its scope.  Com_Error longjmps past the
+// destructor, SV_ReleaseCollisionLock cleans up after that
 
 
 int SV_AreaEntities( const vec3_t mins, const vec3_t maxs, int *entityList, int maxcount );
@@ -415,9 +566,43 @@ void SV_Trace( trace_t *results, const vec3_t start, const vec3_t mins, const ve
 void SV_ClipToEntity( trace_t *trace, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int entityNum, int contentmask, int capsule );
 // clip to a specific entity
 
+
+int SV_EntityPairs( const int *entityNums, int numEntities, int *pairs, int maxPairs );
+// returns entity number pairs ( pairs[i*2], pairs[i*2+1] ) for every linked entity
+// touching one of entityNums, pairs within the set are only reported once
+
+int SV_SweepEntitiesInBox( const vec3_t mins, const vec3_t maxs, int *entityList, int maxcount );
+// the same entities SV_AreaEntities finds, taken from the sweep and prune list,
+// ordered along x instead of by sector
+
+
+void SV_TraceBatch( const traceRequest_t *requests, trace_t *results, int count );
+// same as calling SV_Trace for every request in order, the results are identical,
+// but nearby requests share a single entity query
+
 //
 // sv_net_chan.c
 //
 void SV_Netchan_Transmit( client_t *client, msg_t *msg);	//int length, const byte *data );
 void SV_Netchan_TransmitNextFragment( netchan_t *chan );
 qboolean SV_Netchan_Process( client_t *client, msg_t *msg );
+
+//
+// sv_pool.c
+//
+typedef enum {
+	POOL_GAME,			// G_TRUEMALLOC
+	POOL_BOTGAME,		// Bot_GetMemoryGame
+	POOL_BOTLIB,		// BotImport_GetMemory
+	POOL_MAX
+} poolTag_t;
+
+void	*SV_PoolAlloc( int size, poolTag_t tag );
+// zeroed, small sizes come from the size class pools and the rest from the zone
+
+void	SV_PoolFree( void *ptr );
+int		SV_PoolSmallBytes( poolTag_t tag );
+// bytes of pool blocks tag holds, the zone's own numbers don't include these
+
+void	SV_PoolCheckLeaks( poolTag_t tag, qboolean reclaim );
+void	SV_PoolStats_f( void );
@@ -805,6 +805,11 @@ void SV_SendClientMessages( void ) {
 	int			i;
 	client_t	*c;
 
+	// hand out this frame's share of the download bandwidth
+#ifndef _XBOX	// No downloads on Xbox
+	SV_ScheduleDownloads();
+#endif
+
 	// send a message to each connected client
 	for (i=0, c = svs.clients ; i < sv_maxclients->integer ; i++, c++) {
 		if (!c->state) {
@@ -7,121 +7,1337 @@
 #include <jampio/common/MiniHeap_globals.h>
 #include "server.h"
 
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+#if defined(__SSE__) || defined(_M_X64) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 1 )
+#define SECTOR_SSE
+#include <xmmintrin.h>
+#endif
+
+/*
+===============================================================================
+
+COLLISION LOCK
+
+The collision model and ghoul2 code keep global scratch state (the temp box
+model, check counts, the ghoul2 vertex space), so every call into them from
+the trace path holds sv_collisionLock, together with any clip handle it got
+from SV_ClipHandleForEntity.  Everything on the server side of a trace keeps
+its scratch on the stack, so traces may run on several threads at once, as
+long as nothing links or unlinks entities meanwhile.
+
+Com_Error longjmps out of the collision code without running any
+destructors, so the lock can still be held by the thread that dropped the
+map.  SV_ReleaseCollisionLock is called when the game shuts down and when the
+next world is cleared, and unlocks it if this thread still holds it.
+
+===============================================================================
+*/
+
+static std::mutex				sv_collisionLock;
+static thread_local qboolean	sv_collisionLockHeld;
+
+void SV_LockCollision( void ) {
+	sv_collisionLock.lock();
+	sv_collisionLockHeld = qtrue;
+}
+
+void SV_UnlockCollision( void ) {
+	sv_collisionLockHeld = qfalse;
+	sv_collisionLock.unlock();
+}
+
+void SV_ReleaseCollisionLock( void ) {
+	if ( sv_collisionLockHeld ) {
+		Com_DPrintf( "SV_ReleaseCollisionLock: still held after an error\n" );
+		SV_UnlockCollision();
+	}
+}
+
+/*
+===============================================================================
+
+TRACE STATISTICS
+
+With sv_traceStats set, traces, point contents, area queries and ghoul2
+collision tests are timed and counted against the syscall or subsystem that
+asked for them.  Times are inclusive, a trace's own area query and ghoul2
+tests also show up under their own operation.  When it is off the only cost
+is the cvar check.
+
+===============================================================================
+*/
+
+typedef enum {
+	TRACEOP_TRACE,
+	TRACEOP_TRACEBATCH,
+	TRACEOP_POINTCONTENTS,
+	TRACEOP_AREAENTITIES,
+	TRACEOP_G2COLLISION,
+	TRACEOP_MAX
+} traceOp_t;
+
+#define	TRACESTATS_BUCKETS		16		// bucket i holds times below 2^i usec, the last one everything else
+
+typedef struct {
+	int			count;
+	long long	totalUsec;
+	int			maxUsec;
+	int			buckets[TRACESTATS_BUCKETS];
+} traceStat_t;
+
+static const char *sv_traceSourceNames[TRACESRC_MAX] = {
+	"other",
+	"G_TRACE",
+	"G_G2TRACE",
+	"G_TRACECAPSULE",
+	"G_POINT_CONTENTS",
+	"G_ENTITIES_IN_BOX",
+	"G_EXT_TRACEBATCH",
+	"nav",
+	"bot import"
+};
+
+static const char *sv_traceOpNames[TRACEOP_MAX] = {
+	"trace",
+	"trace batch",
+	"point contents",
+	"area entities",
+	"g2 collision"
+};
+
+static traceStat_t			sv_traceStatTable[TRACESRC_MAX][TRACEOP_MAX];
+static std::mutex			sv_traceStatsLock;
+static thread_local traceSource_t	sv_traceSource = TRACESRC_OTHER;
+static int					sv_traceStatsNextDump;
+
+traceSource_t SV_SetTraceSource( traceSource_t source ) {
+	traceSource_t	old;
+
+	old = sv_traceSource;
+	sv_traceSource = source;
+	return old;
+}
+
+static long long SV_TraceClock( void ) {
+	return std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+/*
+================
+SV_TraceStatsStart
+
+Returns the start time to hand to SV_TraceStatsEnd, or -1 if nothing is measured
+================
+*/
+static long long SV_TraceStatsStart( void ) {
+	if ( !sv_traceStats || !sv_traceStats->integer ) {
+		return -1;
+	}
+	return SV_TraceClock();
+}
+
+static void SV_TraceStatsEnd( traceOp_t op, long long start ) {
+	traceStat_t	*stat;
+	int			usec, bucket;
+
+	if ( start < 0 ) {
+		return;
+	}
+
+	usec = (int)( SV_TraceClock() - start );
+	for ( bucket = 0 ; bucket < TRACESTATS_BUCKETS - 1 && usec >= ( 1 << bucket ) ; bucket++ ) {
+	}
+
+	std::lock_guard<std::mutex>	lock( sv_traceStatsLock );
+
+	stat = &sv_traceStatTable[sv_traceSource][op];
+	stat->count++;
+	stat->totalUsec += usec;
+	if ( usec > stat->maxUsec ) {
+		stat->maxUsec = usec;
+	}
+	stat->buckets[bucket]++;
+}
+
+/*
+================
+SV_TraceStatsReport
+
+Prints the table to the console, or to f if it is set.  With reset the
+table is cleared in the same lock as it is copied, so no trace is lost
+================
+*/
+static void SV_TraceStatsReport( fileHandle_t f, qboolean reset ) {
+	traceStat_t	stats[TRACESRC_MAX][TRACEOP_MAX];
+	traceStat_t	*stat;
+	char		line[1024];
+	int			source, op, i;
+
+	{
+		std::lock_guard<std::mutex>	lock( sv_traceStatsLock );
+		Com_Memcpy( stats, sv_traceStatTable, sizeof( stats ) );
+		if ( reset ) {
+			Com_Memset( sv_traceStatTable, 0, sizeof( sv_traceStatTable ) );
+		}
+	}
+
+	Com_sprintf( line, sizeof( line ), "%-18s %-15s %9s %9s %9s  usec histogram\n", "source", "operation", "calls", "avg usec", "max usec" );
+	if ( f ) {
+		FS_Write( line, strlen( line ), f );
+	} else {
+		Com_Printf( "%s", line );
+	}
+
+	for ( source = 0 ; source < TRACESRC_MAX ; source++ ) {
+		for ( op = 0 ; op < TRACEOP_MAX ; op++ ) {
+			stat = &stats[source][op];
+			if ( !stat->count ) {
+				continue;
+			}
+
+			Com_sprintf( line, sizeof( line ), "%-18s %-15s %9i %9.1f %9i ", sv_traceSourceNames[source], sv_traceOpNames[op],
+				stat->count, (float)stat->totalUsec / stat->count, stat->maxUsec );
+			for ( i = 0 ; i < TRACESTATS_BUCKETS ; i++ ) {
+				if ( !stat->buckets[i] ) {
+					continue;
+				}
+				if ( i == TRACESTATS_BUCKETS - 1 ) {
+					Q_strcat( line, sizeof( line ), va( " >=%i:%i", 1 << ( i - 1 ), stat->buckets[i] ) );
+				} else {
+					Q_strcat( line, sizeof( line ), va( " <%i:%i", 1 << i, stat->buckets[i] ) );
+				}
+			}
+			Q_strcat( line, sizeof( line ), "\n" );
+
+			if ( f ) {
+				FS_Write( line, strlen( line ), f );
+			} else {
+				Com_Printf( "%s", line );
+			}
+		}
+	}
+}
+
+/*
+================
+SV_TraceStats_f
+
+tracestats [reset]
+================
+*/
+void SV_TraceStats_f( void ) {
+	if ( !Q_stricmp( Cmd_Argv( 1 ), "reset" ) ) {
+		std::lock_guard<std::mutex>	lock( sv_traceStatsLock );
+		Com_Memset( sv_traceStatTable, 0, sizeof( sv_traceStatTable ) );
+		return;
+	}
+
+	if ( !sv_traceStats->integer ) {
+		Com_Printf( "sv_traceStats is off, nothing is being measured.\n" );
+	}
+	SV_TraceStatsReport( 0, qfalse );
+}
+
+/*
+================
+SV_TraceStatsFrame
+
+Every sv_traceStatsDump seconds appends the table to tracestats.log and
+starts it over, so each block covers one interval
+================
+*/
+void SV_TraceStatsFrame( void ) {
+	fileHandle_t	f;
+	char			*header;
+	int				now;
+
+	if ( !sv_traceStats->integer || sv_traceStatsDump->integer <= 0 ) {
+		sv_traceStatsNextDump = 0;
+		return;
+	}
+
+	now = Sys_Milliseconds();
+	if ( !sv_traceStatsNextDump ) {
+		sv_traceStatsNextDump = now + sv_traceStatsDump->integer * 1000;
+		return;
+	}
+	if ( now - sv_traceStatsNextDump < 0 ) {
+		return;
+	}
+	sv_traceStatsNextDump = now + sv_traceStatsDump->integer * 1000;
+
+	FS_FOpenFileByMode( "tracestats.log", &f, FS_APPEND );
+	if ( !f ) {
+		Com_Printf( "Couldn't open tracestats.log for writing.\n" );
+		return;
+	}
+	header = va( "--- %s, server time %i ---\n", sv_mapname->string, svs.time );
+	FS_Write( header, strlen( header ), f );
+	SV_TraceStatsReport( f, qtrue );
+	FS_FCloseFile( f );
+}
+
 /*
 ================
 SV_ClipHandleForEntity
 
-Returns a headnode that can be used for testing or clipping to a
-given entity.  If the entity is a bsp model, the headnode will
-be returned, otherwise a custom box tree will be constructed.
-================
-*/
-clipHandle_t SV_ClipHandleForEntity( const sharedEntity_t *ent ) {
-	if ( ent->r.bmodel ) {
-		// explicit hulls in the BSP model
-		return CM_InlineModel( ent->s.modelindex );
+Returns a headnode that can be used for testing or clipping to a
+given entity.  If the entity is a bsp model, the headnode will
+be returned, otherwise a custom box tree will be constructed.
+The caller must hold the collision lock for as long as it uses the handle.
+================
+*/
+clipHandle_t SV_ClipHandleForEntity( const sharedEntity_t *ent ) {
+	if ( ent->r.bmodel ) {
+		// explicit hulls in the BSP model
+		return CM_InlineModel( ent->s.modelindex );
+	}
+	if ( ent->r.svFlags & SVF_CAPSULE ) {
+		// create a temp capsule from bounding box sizes
+		return CM_TempBoxModel( ent->r.mins, ent->r.maxs, qtrue );
+	}
+
+	// create a temp tree from bounding box sizes
+	return CM_TempBoxModel( ent->r.mins, ent->r.maxs, qfalse );
+}
+
+
+
+/*
+===============================================================================
+
+ENTITY CHECKING
+
+To avoid linearly searching through lists of entities during environment testing,
+linked entities are kept in chains hung off a spatial broadphase.  Every entity
+sits in exactly one sector chain, the broadphase decides which sector that is
+and which sectors an area query has to look at.
+
+Two broadphases are available, picked with sv_broadphase on the next map load:
+
+0: the original evenly spaced, axially aligned bsp tree.  Entities are kept
+   at the final leafs, or at the first node that splits them.  This is the
+   default, it returns entities in the order the game has always seen.
+
+1: a loose octree.  Every cell's bounds are doubled, so an entity can always
+   go into the cell holding its center at the depth matching its size, and
+   nothing gets stuck high up in the tree just for straddling a split.
+   Cells are only created where there are entities.
+
+Next to its entity chain, newest link first as it has always been, a sector
+keeps a structure of arrays copy of the entities' absolute bounds in fixed
+size blocks, so area queries can test several entities at once without
+touching the game's entity memory.  The blocks are packed, only the last
+block of a sector is ever partially filled, so their order changes as
+entities come and go.  The chain is doubly linked, so an entity comes out
+of it without a walk.  A query that finds more than one entity in a sector
+hands them back in chain order, the order the game has always seen.
+
+===============================================================================
+*/
+
+#define	SECTOR_BLOCK_SIZE	8		// keep a multiple of 4 for the SSE path
+
+typedef struct sectorBlock_s {
+	float					absmin[3][SECTOR_BLOCK_SIZE];
+	float					absmax[3][SECTOR_BLOCK_SIZE];
+	int						entityNums[SECTOR_BLOCK_SIZE];
+	int						numEntities;
+	struct sectorBlock_s	*prev, *next;
+} sectorBlock_t;
+
+typedef struct worldSector_s {
+	svEntity_t		*entities;		// newest link first
+	sectorBlock_t	*firstBlock;
+	sectorBlock_t	*lastBlock;
+	int				numEntities;
+} worldSector_t;
+
+// every sector holding n entities uses at most n / SECTOR_BLOCK_SIZE + 1 blocks
+#define	MAX_SECTOR_BLOCKS	( MAX_GENTITIES + MAX_GENTITIES / SECTOR_BLOCK_SIZE + 1 )
+
+static sectorBlock_t	sv_sectorBlocks[MAX_SECTOR_BLOCKS];
+static sectorBlock_t	*sv_freeSectorBlocks;
+static int				sv_numSectorBlocks;		// high water mark in sv_sectorBlocks
+
+typedef struct {
+	const float	*mins;
+	const float	*maxs;
+	int			*list;
+	int			count, maxcount;
+} areaParms_t;
+
+typedef struct {
+	const char		*name;
+	void			(*Clear)( const vec3_t mins, const vec3_t maxs );
+	worldSector_t	*(*SectorForBounds)( const vec3_t absmin, const vec3_t absmax );
+	void			(*SectorEmptied)( worldSector_t *sector );	// optional
+	void			(*AreaEntities)( areaParms_t *ap );
+	void			(*SectorList)( void );
+} broadphase_t;
+
+static const broadphase_t	*sv_broadphaseImpl;
+
+/*
+====================
+SV_ClearSectorBlocks
+====================
+*/
+static void SV_ClearSectorBlocks( void ) {
+	sv_freeSectorBlocks = NULL;
+	sv_numSectorBlocks = 0;
+}
+
+/*
+====================
+SV_AddToSector
+
+Puts the entity at the head of the sector's chain and appends a copy of
+its bounds to the sector's blocks
+====================
+*/
+static void SV_AddToSector( worldSector_t *ws, svEntity_t *ent, const vec3_t absmin, const vec3_t absmax ) {
+	sectorBlock_t	*block;
+	int				i, slot;
+
+	block = ws->lastBlock;
+	if ( !block || block->numEntities == SECTOR_BLOCK_SIZE ) {
+		if ( sv_freeSectorBlocks ) {
+			block = sv_freeSectorBlocks;
+			sv_freeSectorBlocks = block->next;
+		} else if ( sv_numSectorBlocks < MAX_SECTOR_BLOCKS ) {
+			block = &sv_sectorBlocks[sv_numSectorBlocks++];
+		} else {
+			Com_Error( ERR_DROP, "SV_AddToSector: MAX_SECTOR_BLOCKS" );
+		}
+
+		block->numEntities = 0;
+		block->next = NULL;
+		block->prev = ws->lastBlock;
+		if ( ws->lastBlock ) {
+			ws->lastBlock->next = block;
+		} else {
+			ws->firstBlock = block;
+		}
+		ws->lastBlock = block;
+	}
+
+	slot = block->numEntities++;
+	for ( i = 0 ; i < 3 ; i++ ) {
+		block->absmin[i][slot] = absmin[i];
+		block->absmax[i][slot] = absmax[i];
+	}
+	block->entityNums[slot] = ent - sv.svEntities;
+	ws->numEntities++;
+
+	ent->worldSector = ws;
+	ent->worldSectorBlock = block;
+	ent->worldSectorSlot = slot;
+
+	ent->prevEntityInWorldSector = NULL;
+	ent->nextEntityInWorldSector = ws->entities;
+	if ( ws->entities ) {
+		ws->entities->prevEntityInWorldSector = ent;
+	}
+	ws->entities = ent;
+}
+
+/*
+====================
+SV_UnchainFromSector
+====================
+*/
+static void SV_UnchainFromSector( worldSector_t *ws, svEntity_t *ent ) {
+	if ( ent->prevEntityInWorldSector ) {
+		ent->prevEntityInWorldSector->nextEntityInWorldSector = ent->nextEntityInWorldSector;
+	} else {
+		ws->entities = ent->nextEntityInWorldSector;
+	}
+	if ( ent->nextEntityInWorldSector ) {
+		ent->nextEntityInWorldSector->prevEntityInWorldSector = ent->prevEntityInWorldSector;
+	}
+
+	ent->nextEntityInWorldSector = NULL;
+	ent->prevEntityInWorldSector = NULL;
+}
+
+/*
+====================
+SV_RelinkInSector
+
+Moves the entity to the head of its sector's chain, where unlinking and
+linking it again would have put it
+====================
+*/
+static void SV_RelinkInSector( svEntity_t *ent ) {
+	worldSector_t	*ws;
+
+	ws = ent->worldSector;
+	if ( ws->entities == ent ) {
+		return;
+	}
+
+	SV_UnchainFromSector( ws, ent );
+	ent->nextEntityInWorldSector = ws->entities;
+	ws->entities->prevEntityInWorldSector = ent;
+	ws->entities = ent;
+}
+
+/*
+====================
+SV_RemoveFromSector
+
+Takes the entity out of its sector's chain, and out of its blocks by moving
+the sector's last entry into its slot, returns the sector
+====================
+*/
+static worldSector_t *SV_RemoveFromSector( svEntity_t *ent ) {
+	worldSector_t	*ws;
+	sectorBlock_t	*block, *last;
+	svEntity_t		*moved;
+	int				i, slot, lastSlot;
+
+	ws = ent->worldSector;
+	block = ent->worldSectorBlock;
+	slot = ent->worldSectorSlot;
+	ent->worldSector = NULL;
+	ent->worldSectorBlock = NULL;
+	SV_UnchainFromSector( ws, ent );
+
+	last = ws->lastBlock;
+	lastSlot = last->numEntities - 1;
+	if ( block != last || slot != lastSlot ) {
+		for ( i = 0 ; i < 3 ; i++ ) {
+			block->absmin[i][slot] = last->absmin[i][lastSlot];
+			block->absmax[i][slot] = last->absmax[i][lastSlot];
+		}
+		block->entityNums[slot] = last->entityNums[lastSlot];
+
+		moved = &sv.svEntities[block->entityNums[slot]];
+		moved->worldSectorBlock = block;
+		moved->worldSectorSlot = slot;
+	}
+
+	ws->numEntities--;
+	if ( --last->numEntities == 0 ) {
+		ws->lastBlock = last->prev;
+		if ( ws->lastBlock ) {
+			ws->lastBlock->next = NULL;
+		} else {
+			ws->firstBlock = NULL;
+		}
+		last->next = sv_freeSectorBlocks;
+		sv_freeSectorBlocks = last;
+	}
+
+	return ws;
+}
+
+/*
+====================
+SV_EntityTouchesBox
+
+Same test SV_AreaSectorEntities applies, for an entity that is linked
+====================
+*/
+static qboolean SV_EntityTouchesBox( const svEntity_t *ent, const vec3_t mins, const vec3_t maxs ) {
+	const sectorBlock_t	*block;
+	int					slot;
+
+	block = ent->worldSectorBlock;
+	slot = ent->worldSectorSlot;
+
+	if ( block->absmin[0][slot] > maxs[0]
+	|| block->absmin[1][slot] > maxs[1]
+	|| block->absmin[2][slot] > maxs[2]
+	|| block->absmax[0][slot] < mins[0]
+	|| block->absmax[1][slot] < mins[1]
+	|| block->absmax[2][slot] < mins[2]) {
+		return qfalse;
+	}
+	return qtrue;
+}
+
+/*
+====================
+SV_EntityHasBounds
+
+True if the entity was linked with exactly these bounds
+====================
+*/
+static qboolean SV_EntityHasBounds( const svEntity_t *ent, const vec3_t absmin, const vec3_t absmax ) {
+	const sectorBlock_t	*block;
+	int					i, slot;
+
+	block = ent->worldSectorBlock;
+	slot = ent->worldSectorSlot;
+
+	for ( i = 0 ; i < 3 ; i++ ) {
+		if ( block->absmin[i][slot] != absmin[i] || block->absmax[i][slot] != absmax[i] ) {
+			return qfalse;
+		}
+	}
+	return qtrue;
+}
+
+/*
+====================
+SV_AreaSectorEntities
+
+Adds the entities in one sector that touch the query bounds, in the
+sector's chain order
+====================
+*/
+static void SV_AreaSectorEntities( worldSector_t *sector, areaParms_t *ap ) {
+	sectorBlock_t	*block;
+	svEntity_t		*check;
+	int				i, bits, found, first;
+#ifdef SECTOR_SSE
+	__m128			qmins[3], qmaxs[3], out;
+	int				j;
+
+	for ( i = 0 ; i < 3 ; i++ ) {
+		qmins[i] = _mm_set1_ps( ap->mins[i] );
+		qmaxs[i] = _mm_set1_ps( ap->maxs[i] );
+	}
+#endif
+
+	found = 0;
+	first = 0;
+	for ( block = sector->firstBlock ; block ; block = block->next ) {
+		// one bit per slot that touches the query bounds
+#ifdef SECTOR_SSE
+		bits = 0;
+		for ( j = 0 ; j < SECTOR_BLOCK_SIZE ; j += 4 ) {
+			out = _mm_cmpgt_ps( _mm_loadu_ps( &block->absmin[0][j] ), qmaxs[0] );
+			out = _mm_or_ps( out, _mm_cmpgt_ps( _mm_loadu_ps( &block->absmin[1][j] ), qmaxs[1] ) );
+			out = _mm_or_ps( out, _mm_cmpgt_ps( _mm_loadu_ps( &block->absmin[2][j] ), qmaxs[2] ) );
+			out = _mm_or_ps( out, _mm_cmplt_ps( _mm_loadu_ps( &block->absmax[0][j] ), qmins[0] ) );
+			out = _mm_or_ps( out, _mm_cmplt_ps( _mm_loadu_ps( &block->absmax[1][j] ), qmins[1] ) );
+			out = _mm_or_ps( out, _mm_cmplt_ps( _mm_loadu_ps( &block->absmax[2][j] ), qmins[2] ) );
+			bits |= ( ~_mm_movemask_ps( out ) & 15 ) << j;
+		}
+		bits &= ( 1 << block->numEntities ) - 1;
+#else
+		bits = 0;
+		for ( i = 0 ; i < block->numEntities ; i++ ) {
+			if ( block->absmin[0][i] > ap->maxs[0]
+			|| block->absmin[1][i] > ap->maxs[1]
+			|| block->absmin[2][i] > ap->maxs[2]
+			|| block->absmax[0][i] < ap->mins[0]
+			|| block->absmax[1][i] < ap->mins[1]
+			|| block->absmax[2][i] < ap->mins[2]) {
+				continue;
+			}
+			bits |= 1 << i;
+		}
+#endif
+
+		for ( i = 0 ; bits ; i++, bits >>= 1 ) {
+			if ( bits & 1 ) {
+				if ( !found++ ) {
+					first = block->entityNums[i];
+				}
+			}
+		}
+	}
+
+	if ( !found ) {
+		return;
+	}
+
+	if ( found == 1 ) {
+		// nothing to order
+		if ( ap->count == ap->maxcount ) {
+			Com_DPrintf ("SV_AreaEntities: MAXCOUNT\n");
+			return;
+		}
+		ap->list[ap->count] = first;
+		ap->count++;
+		return;
+	}
+
+	// the blocks don't keep the link order, the chain does
+	for ( check = sector->entities ; check && found ; check = check->nextEntityInWorldSector ) {
+		if ( !SV_EntityTouchesBox( check, ap->mins, ap->maxs ) ) {
+			continue;
+		}
+		found--;
+
+		if ( ap->count == ap->maxcount ) {
+			Com_DPrintf ("SV_AreaEntities: MAXCOUNT\n");
+			return;
+		}
+
+		ap->list[ap->count] = check - sv.svEntities;
+		ap->count++;
+	}
+}
+
+/*
+===============================================================================
+
+UNIFORM SECTOR TREE
+
+===============================================================================
+*/
+
+typedef struct areaNode_s {
+	worldSector_t	sector;		// must be first
+	int		axis;		// -1 = leaf node
+	float	dist;
+	struct areaNode_s	*children[2];
+} areaNode_t;
+
+#define	AREA_DEPTH	4
+#define	AREA_NODES	64
+
+static areaNode_t	sv_areaNodes[AREA_NODES];
+static int			sv_numAreaNodes;
+
+/*
+===============
+SV_CreateAreaNode
+
+Builds a uniformly subdivided tree for the given world size
+===============
+*/
+static areaNode_t *SV_CreateAreaNode( int depth, const vec3_t mins, const vec3_t maxs ) {
+	areaNode_t	*anode;
+	vec3_t		size;
+	vec3_t		mins1, maxs1, mins2, maxs2;
+
+	anode = &sv_areaNodes[sv_numAreaNodes];
+	sv_numAreaNodes++;
+
+	if (depth == AREA_DEPTH) {
+		anode->axis = -1;
+		anode->children[0] = anode->children[1] = NULL;
+		return anode;
+	}
+	
+	VectorSubtract (maxs, mins, size);
+	if (size[0] > size[1]) {
+		anode->axis = 0;
+	} else {
+		anode->axis = 1;
+	}
+
+	anode->dist = 0.5 * (maxs[anode->axis] + mins[anode->axis]);
+	VectorCopy (mins, mins1);	
+	VectorCopy (mins, mins2);	
+	VectorCopy (maxs, maxs1);	
+	VectorCopy (maxs, maxs2);	
+	
+	maxs1[anode->axis] = mins2[anode->axis] = anode->dist;
+	
+	anode->children[0] = SV_CreateAreaNode (depth+1, mins2, maxs2);
+	anode->children[1] = SV_CreateAreaNode (depth+1, mins1, maxs1);
+
+	return anode;
+}
+
+static void SV_UniformClear( const vec3_t mins, const vec3_t maxs ) {
+	Com_Memset( sv_areaNodes, 0, sizeof(sv_areaNodes) );
+	sv_numAreaNodes = 0;
+
+	SV_CreateAreaNode( 0, mins, maxs );
+}
+
+/*
+===============
+SV_UniformSectorForBounds
+
+Finds the first node that the box crosses
+===============
+*/
+static worldSector_t *SV_UniformSectorForBounds( const vec3_t absmin, const vec3_t absmax ) {
+	areaNode_t	*node;
+
+	node = sv_areaNodes;
+	while (1)
+	{
+		if (node->axis == -1)
+			break;
+		if ( absmin[node->axis] > node->dist)
+			node = node->children[0];
+		else if ( absmax[node->axis] < node->dist)
+			node = node->children[1];
+		else
+			break;		// crosses the node
+	}
+
+	return &node->sector;
+}
+
+static void SV_UniformAreaEntities_r( areaNode_t *node, areaParms_t *ap ) {
+	SV_AreaSectorEntities( &node->sector, ap );
+	
+	if (node->axis == -1) {
+		return;		// terminal node
+	}
+
+	// recurse down both sides
+	if ( ap->maxs[node->axis] > node->dist ) {
+		SV_UniformAreaEntities_r ( node->children[0], ap );
+	}
+	if ( ap->mins[node->axis] < node->dist ) {
+		SV_UniformAreaEntities_r ( node->children[1], ap );
+	}
+}
+
+static void SV_UniformAreaEntities( areaParms_t *ap ) {
+	SV_UniformAreaEntities_r( sv_areaNodes, ap );
+}
+
+static void SV_UniformSectorList( void ) {
+	int				i;
+
+	for ( i = 0 ; i < AREA_NODES ; i++ ) {
+		Com_Printf( "sector %i: %i entities\n", i, sv_areaNodes[i].sector.numEntities );
+	}
+}
+
+static const broadphase_t	sv_uniformBroadphase = {
+	"uniform sector tree",
+	SV_UniformClear,
+	SV_UniformSectorForBounds,
+	NULL,
+	SV_UniformAreaEntities,
+	SV_UniformSectorList
+};
+
+/*
+===============================================================================
+
+LOOSE OCTREE
+
+===============================================================================
+*/
+
+#define	OCTREE_MAX_DEPTH	10
+#define	OCTREE_MIN_CELL		32		// don't make cells with a half size below this
+#define	OCTREE_MAX_NODES	( 1 + MAX_GENTITIES * OCTREE_MAX_DEPTH )
+
+typedef struct octreeNode_s {
+	worldSector_t			sector;			// must be first
+	vec3_t					center;
+	float					halfSize;		// of the cell, the loose bounds are twice as big
+	int						depth;
+	int						numChildren;
+	struct octreeNode_s		*parent;
+	struct octreeNode_s		*children[8];	// bit 0 = +x, bit 1 = +y, bit 2 = +z
+} octreeNode_t;
+
+static octreeNode_t	sv_octreeNodes[OCTREE_MAX_NODES];
+static octreeNode_t	*sv_octreeFreeNodes;
+static int			sv_octreeNumNodes;		// high water mark in sv_octreeNodes
+
+static void SV_OctreeClear( const vec3_t mins, const vec3_t maxs ) {
+	octreeNode_t	*root;
+	int				i;
+	float			size;
+
+	sv_octreeFreeNodes = NULL;
+	sv_octreeNumNodes = 1;
+
+	root = &sv_octreeNodes[0];
+	Com_Memset( root, 0, sizeof( *root ) );
+
+	for ( i = 0 ; i < 3 ; i++ ) {
+		root->center[i] = 0.5f * ( mins[i] + maxs[i] );
+		size = 0.5f * ( maxs[i] - mins[i] );
+		if ( size > root->halfSize ) {
+			root->halfSize = size;
+		}
+	}
+	root->halfSize += 1;
+}
+
+static octreeNode_t *SV_OctreeAllocNode( octreeNode_t *parent, int index ) {
+	octreeNode_t	*node;
+	int				i;
+
+	if ( sv_octreeFreeNodes ) {
+		node = sv_octreeFreeNodes;
+		sv_octreeFreeNodes = node->parent;
+	} else if ( sv_octreeNumNodes < OCTREE_MAX_NODES ) {
+		node = &sv_octreeNodes[sv_octreeNumNodes++];
+	} else {
+		return NULL;
+	}
+
+	Com_Memset( node, 0, sizeof( *node ) );
+	node->halfSize = parent->halfSize * 0.5f;
+	node->depth = parent->depth + 1;
+	for ( i = 0 ; i < 3 ; i++ ) {
+		node->center[i] = parent->center[i] + ( ( index & ( 1 << i ) ) ? node->halfSize : -node->halfSize );
+	}
+
+	node->parent = parent;
+	parent->children[index] = node;
+	parent->numChildren++;
+
+	return node;
+}
+
+/*
+===============
+SV_OctreeSectorForBounds
+
+Walks down the cells holding the box center for as long as the child cells
+are still at least as big as the box, creating them where needed
+===============
+*/
+static worldSector_t *SV_OctreeSectorForBounds( const vec3_t absmin, const vec3_t absmax ) {
+	octreeNode_t	*node, *child;
+	vec3_t			center;
+	float			extent, e;
+	int				i, index;
+
+	node = &sv_octreeNodes[0];
+
+	extent = 0;
+	for ( i = 0 ; i < 3 ; i++ ) {
+		center[i] = 0.5f * ( absmin[i] + absmax[i] );
+		e = 0.5f * ( absmax[i] - absmin[i] );
+		if ( e > extent ) {
+			extent = e;
+		}
+		if ( center[i] < node->center[i] - node->halfSize || center[i] > node->center[i] + node->halfSize ) {
+			return &node->sector;	// center is outside the world, keep it at the root
+		}
+	}
+
+	while ( node->depth < OCTREE_MAX_DEPTH ) {
+		e = node->halfSize * 0.5f;
+		if ( e < extent || e < OCTREE_MIN_CELL ) {
+			break;
+		}
+
+		index = 0;
+		for ( i = 0 ; i < 3 ; i++ ) {
+			if ( center[i] >= node->center[i] ) {
+				index |= 1 << i;
+			}
+		}
+
+		child = node->children[index];
+		if ( !child ) {
+			child = SV_OctreeAllocNode( node, index );
+			if ( !child ) {
+				break;	// out of nodes, a coarser cell will do
+			}
+		}
+		node = child;
+	}
+
+	return &node->sector;
+}
+
+/*
+===============
+SV_OctreeSectorEmptied
+
+Gives back cells that no longer hold anything
+===============
+*/
+static void SV_OctreeSectorEmptied( worldSector_t *sector ) {
+	octreeNode_t	*node, *parent;
+	int				i;
+
+	node = (octreeNode_t *)sector;
+
+	while ( node->parent && !node->sector.numEntities && !node->numChildren ) {
+		parent = node->parent;
+		for ( i = 0 ; i < 8 ; i++ ) {
+			if ( parent->children[i] == node ) {
+				parent->children[i] = NULL;
+				break;
+			}
+		}
+		parent->numChildren--;
+
+		node->parent = sv_octreeFreeNodes;
+		sv_octreeFreeNodes = node;
+
+		node = parent;
+	}
+}
+
+static void SV_OctreeAreaEntities_r( octreeNode_t *node, areaParms_t *ap ) {
+	octreeNode_t	*child;
+	float			loose;
+	int				i;
+
+	SV_AreaSectorEntities( &node->sector, ap );
+
+	if ( !node->numChildren ) {
+		return;
 	}
-	if ( ent->r.svFlags & SVF_CAPSULE ) {
-		// create a temp capsule from bounding box sizes
-		return CM_TempBoxModel( ent->r.mins, ent->r.maxs, qtrue );
+
+	for ( i = 0 ; i < 8 ; i++ ) {
+		child = node->children[i];
+		if ( !child ) {
+			continue;
+		}
+
+		// entities can reach up to a whole cell size out of their cell,
+		// pad it a little more so float error never drops anything
+		loose = child->halfSize * 2 + 1;
+		if ( child->center[0] - loose > ap->maxs[0]
+		|| child->center[1] - loose > ap->maxs[1]
+		|| child->center[2] - loose > ap->maxs[2]
+		|| child->center[0] + loose < ap->mins[0]
+		|| child->center[1] + loose < ap->mins[1]
+		|| child->center[2] + loose < ap->mins[2] ) {
+			continue;
+		}
+
+		SV_OctreeAreaEntities_r( child, ap );
 	}
+}
 
-	// create a temp tree from bounding box sizes
-	return CM_TempBoxModel( ent->r.mins, ent->r.maxs, qfalse );
+static void SV_OctreeAreaEntities( areaParms_t *ap ) {
+	SV_OctreeAreaEntities_r( &sv_octreeNodes[0], ap );
+}
+
+static void SV_OctreeSectorList_r( octreeNode_t *node, int *cells, int *entities, int *most ) {
+	int			i, c;
+
+	c = node->sector.numEntities;
+
+	cells[node->depth]++;
+	entities[node->depth] += c;
+	if ( c > most[node->depth] ) {
+		most[node->depth] = c;
+	}
+
+	for ( i = 0 ; i < 8 ; i++ ) {
+		if ( node->children[i] ) {
+			SV_OctreeSectorList_r( node->children[i], cells, entities, most );
+		}
+	}
 }
 
+static void SV_OctreeSectorList( void ) {
+	int		cells[OCTREE_MAX_DEPTH+1];
+	int		entities[OCTREE_MAX_DEPTH+1];
+	int		most[OCTREE_MAX_DEPTH+1];
+	int		i, total;
+
+	Com_Memset( cells, 0, sizeof( cells ) );
+	Com_Memset( entities, 0, sizeof( entities ) );
+	Com_Memset( most, 0, sizeof( most ) );
+
+	SV_OctreeSectorList_r( &sv_octreeNodes[0], cells, entities, most );
+
+	total = 0;
+	for ( i = 0 ; i <= OCTREE_MAX_DEPTH ; i++ ) {
+		if ( !cells[i] ) {
+			continue;
+		}
+		Com_Printf( "depth %i: cell size %i, %i cells, %i entities, at most %i in one cell\n",
+			i, (int)( sv_octreeNodes[0].halfSize * 2 ) >> i, cells[i], entities[i], most[i] );
+		total += cells[i];
+	}
+	Com_Printf( "%i / %i cells in use\n", total, OCTREE_MAX_NODES );
+}
 
+static const broadphase_t	sv_octreeBroadphase = {
+	"loose octree",
+	SV_OctreeClear,
+	SV_OctreeSectorForBounds,
+	SV_OctreeSectorEmptied,
+	SV_OctreeAreaEntities,
+	SV_OctreeSectorList
+};
 
 /*
 ===============================================================================
 
-ENTITY CHECKING
+SWEEP AND PRUNE
 
-To avoid linearly searching through lists of entities during environment testing,
-the world is carved up with an evenly spaced, axially aligned bsp tree.  Entities
-are kept in chains either at the final leafs, or at the first node that splits
-them, which prevents having to deal with multiple fragments of a single entity.
+Independent of the broadphase, every linked entity is also kept in a list
+sorted on absmin[0].  SV_LinkEntity moves a relinked entity to its new place
+by swapping it past its neighbours, and since things only move a little from
+one frame to the next that is usually no more than a few steps.  A box query
+is then a binary search and a scan over the entities whose x range can
+overlap the box.  Entities wider than SWEEP_LARGE along x would make every
+scan longer, they are kept in a short list that is always tested.
+
+The game gets the box query through G_EXT_SWEEPENTITIESINBOX and the pair
+query through G_EXT_ENTITYPAIRS.
 
 ===============================================================================
 */
 
-typedef struct worldSector_s {
-	int		axis;		// -1 = leaf node
-	float	dist;
-	struct worldSector_s	*children[2];
-	svEntity_t	*entities;
-} worldSector_t;
+#define	SWEEP_LARGE			1024
 
-#define	AREA_DEPTH	4
-#define	AREA_NODES	64
+#define	SWEEP_NONE			0
+#define	SWEEP_SORTED		1
+#define	SWEEP_WIDE			2
+
+typedef struct {
+	float		mins[MAX_GENTITIES];		// absmin[0], ascending
+	float		maxs[MAX_GENTITIES];		// absmax[0]
+	int			entityNums[MAX_GENTITIES];
+	int			numSorted;
+
+	int			wide[MAX_GENTITIES];
+	int			numWide;
+
+	byte		where[MAX_GENTITIES];		// SWEEP_NONE, SWEEP_SORTED or SWEEP_WIDE
+	int			index[MAX_GENTITIES];		// into entityNums or wide
+
+	int			swaps;						// since the map was loaded, for sectorlist
+} sweepList_t;
+
+static sweepList_t	sv_sweep;
+
+static void SV_SweepClear( void ) {
+	Com_Memset( &sv_sweep, 0, sizeof( sv_sweep ) );
+}
+
+static void SV_SweepRemove( int num ) {
+	int		i, last;
+
+	if ( sv_sweep.where[num] == SWEEP_WIDE ) {
+		i = sv_sweep.index[num];
+		last = sv_sweep.wide[--sv_sweep.numWide];
+		sv_sweep.wide[i] = last;
+		sv_sweep.index[last] = i;
+	} else if ( sv_sweep.where[num] == SWEEP_SORTED ) {
+		// keep the order, close the gap
+		for ( i = sv_sweep.index[num] + 1 ; i < sv_sweep.numSorted ; i++ ) {
+			sv_sweep.mins[i-1] = sv_sweep.mins[i];
+			sv_sweep.maxs[i-1] = sv_sweep.maxs[i];
+			sv_sweep.entityNums[i-1] = sv_sweep.entityNums[i];
+			sv_sweep.index[sv_sweep.entityNums[i-1]] = i - 1;
+		}
+		sv_sweep.numSorted--;
+	}
+	sv_sweep.where[num] = SWEEP_NONE;
+}
+
+static void SV_SweepSwap( int a, int b ) {
+	float	f;
+	int		n;
 
-worldSector_t	sv_worldSectors[AREA_NODES];
-int			sv_numworldSectors;
+	f = sv_sweep.mins[a]; sv_sweep.mins[a] = sv_sweep.mins[b]; sv_sweep.mins[b] = f;
+	f = sv_sweep.maxs[a]; sv_sweep.maxs[a] = sv_sweep.maxs[b]; sv_sweep.maxs[b] = f;
+	n = sv_sweep.entityNums[a]; sv_sweep.entityNums[a] = sv_sweep.entityNums[b]; sv_sweep.entityNums[b] = n;
 
+	sv_sweep.index[sv_sweep.entityNums[a]] = a;
+	sv_sweep.index[sv_sweep.entityNums[b]] = b;
+	sv_sweep.swaps++;
+}
 
 /*
 ===============
-SV_SectorList_f
+SV_SweepUpdate
+
+Puts a freshly linked entity in its place
 ===============
 */
-void SV_SectorList_f( void ) {
-	int				i, c;
-	worldSector_t	*sec;
-	svEntity_t		*ent;
+static void SV_SweepUpdate( int num, const vec3_t absmin, const vec3_t absmax ) {
+	int		i;
+
+	if ( absmax[0] - absmin[0] > SWEEP_LARGE ) {
+		if ( sv_sweep.where[num] != SWEEP_WIDE ) {
+			SV_SweepRemove( num );
+			sv_sweep.where[num] = SWEEP_WIDE;
+			sv_sweep.index[num] = sv_sweep.numWide;
+			sv_sweep.wide[sv_sweep.numWide++] = num;
+		}
+		return;
+	}
 
-	for ( i = 0 ; i < AREA_NODES ; i++ ) {
-		sec = &sv_worldSectors[i];
+	if ( sv_sweep.where[num] != SWEEP_SORTED ) {
+		SV_SweepRemove( num );
+		i = sv_sweep.numSorted++;
+		sv_sweep.entityNums[i] = num;
+		sv_sweep.where[num] = SWEEP_SORTED;
+	} else {
+		i = sv_sweep.index[num];
+	}
+	sv_sweep.mins[i] = absmin[0];
+	sv_sweep.maxs[i] = absmax[0];
+	sv_sweep.index[num] = i;
+
+	while ( i > 0 && sv_sweep.mins[i-1] > sv_sweep.mins[i] ) {
+		SV_SweepSwap( i - 1, i );
+		i--;
+	}
+	while ( i < sv_sweep.numSorted - 1 && sv_sweep.mins[i+1] < sv_sweep.mins[i] ) {
+		SV_SweepSwap( i, i + 1 );
+		i++;
+	}
+}
+
+/*
+===============
+SV_SweepBoxEntities
+
+Fills list with the linked entities touching the box, except skip
+===============
+*/
+static int SV_SweepBoxEntities( const vec3_t mins, const vec3_t maxs, int skip, int *list, int maxcount ) {
+	float	lowest;
+	int		lo, hi, mid, i, num, count;
+
+	count = 0;
+
+	// first entity that could still reach the box
+	lowest = mins[0] - SWEEP_LARGE;
+	lo = 0;
+	hi = sv_sweep.numSorted;
+	while ( lo < hi ) {
+		mid = ( lo + hi ) >> 1;
+		if ( sv_sweep.mins[mid] < lowest ) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	for ( i = lo ; i < sv_sweep.numSorted && sv_sweep.mins[i] <= maxs[0] ; i++ ) {
+		num = sv_sweep.entityNums[i];
+		if ( num == skip || sv_sweep.maxs[i] < mins[0] ) {
+			continue;
+		}
+		if ( !SV_EntityTouchesBox( &sv.svEntities[num], mins, maxs ) ) {
+			continue;
+		}
+		if ( count == maxcount ) {
+			return count;
+		}
+		list[count++] = num;
+	}
 
-		c = 0;
-		for ( ent = sec->entities ; ent ; ent = ent->nextEntityInWorldSector ) {
-			c++;
+	for ( i = 0 ; i < sv_sweep.numWide ; i++ ) {
+		num = sv_sweep.wide[i];
+		if ( num == skip || !SV_EntityTouchesBox( &sv.svEntities[num], mins, maxs ) ) {
+			continue;
+		}
+		if ( count == maxcount ) {
+			return count;
 		}
-		Com_Printf( "sector %i: %i entities\n", i, c );
+		list[count++] = num;
 	}
+
+	return count;
 }
 
 /*
 ===============
-SV_CreateworldSector
+SV_EntityPairs
 
-Builds a uniformly subdivided tree for the given world size
+For every linked entity in entityNums, adds a pair for each other linked
+entity whose bounds touch it.  A pair of two entities that were both asked
+for is only reported once.  Returns the number of pairs written, which is
+maxPairs if there wasn't room for all of them.
 ===============
 */
-worldSector_t *SV_CreateworldSector( int depth, vec3_t mins, vec3_t maxs ) {
-	worldSector_t	*anode;
-	vec3_t		size;
-	vec3_t		mins1, maxs1, mins2, maxs2;
+int SV_EntityPairs( const int *entityNums, int numEntities, int *pairs, int maxPairs ) {
+	byte			asked[MAX_GENTITIES];
+	int				touch[MAX_GENTITIES];
+	const svEntity_t	*ent;
+	const sectorBlock_t	*block;
+	vec3_t			mins, maxs;
+	int				i, j, k, num, other, numTouch, numPairs;
+
+	Com_Memset( asked, 0, sizeof( asked ) );
+	for ( i = 0 ; i < numEntities ; i++ ) {
+		if ( entityNums[i] >= 0 && entityNums[i] < MAX_GENTITIES ) {
+			asked[entityNums[i]] = 1;
+		}
+	}
 
-	anode = &sv_worldSectors[sv_numworldSectors];
-	sv_numworldSectors++;
+	numPairs = 0;
+	for ( i = 0 ; i < numEntities ; i++ ) {
+		num = entityNums[i];
+		if ( num < 0 || num >= MAX_GENTITIES || asked[num] != 1 ) {
+			continue;		// out of range or already done
+		}
+		asked[num] = 2;
 
-	if (depth == AREA_DEPTH) {
-		anode->axis = -1;
-		anode->children[0] = anode->children[1] = NULL;
-		return anode;
+		ent = &sv.svEntities[num];
+		if ( !ent->worldSector ) {
+			continue;
+		}
+
+		block = ent->worldSectorBlock;
+		for ( k = 0 ; k < 3 ; k++ ) {
+			mins[k] = block->absmin[k][ent->worldSectorSlot];
+			maxs[k] = block->absmax[k][ent->worldSectorSlot];
+		}
+
+		numTouch = SV_SweepBoxEntities( mins, maxs, num, touch, MAX_GENTITIES );
+		for ( j = 0 ; j < numTouch ; j++ ) {
+			other = touch[j];
+			if ( asked[other] == 2 ) {
+				continue;		// reported from the other side already
+			}
+			if ( numPairs == maxPairs ) {
+				return numPairs;
+			}
+			pairs[numPairs*2] = num;
+			pairs[numPairs*2+1] = other;
+			numPairs++;
+		}
 	}
-	
-	VectorSubtract (maxs, mins, size);
-	if (size[0] > size[1]) {
-		anode->axis = 0;
-	} else {
-		anode->axis = 1;
+
+	return numPairs;
+}
+
+/*
+===============
+SV_SweepEntitiesInBox
+===============
+*/
+int SV_SweepEntitiesInBox( const vec3_t mins, const vec3_t maxs, int *entityList, int maxcount ) {
+	if ( maxcount <= 0 ) {
+		return 0;
 	}
+	return SV_SweepBoxEntities( mins, maxs, -1, entityList, maxcount );
+}
 
-	anode->dist = 0.5 * (maxs[anode->axis] + mins[anode->axis]);
-	VectorCopy (mins, mins1);	
-	VectorCopy (mins, mins2);	
-	VectorCopy (maxs, maxs1);	
-	VectorCopy (maxs, maxs2);	
-	
-	maxs1[anode->axis] = mins2[anode->axis] = anode->dist;
-	
-	anode->children[0] = SV_CreateworldSector (depth+1, mins2, maxs2);
-	anode->children[1] = SV_CreateworldSector (depth+1, mins1, maxs1);
+//===========================================================================
 
-	return anode;
+/*
+===============
+SV_InitWorld
+===============
+*/
+void SV_InitWorld( void ) {
+	sv_broadphase = Cvar_Get( "sv_broadphase", "0", CVAR_ARCHIVE );
+	sv_g2TraceCache = Cvar_Get( "sv_g2TraceCache", "0", CVAR_ARCHIVE );
+	sv_g2TracePrecheck = Cvar_Get( "sv_g2TracePrecheck", "0", CVAR_ARCHIVE );
+	sv_traceStats = Cvar_Get( "sv_traceStats", "0", 0 );
+	sv_traceStatsDump = Cvar_Get( "sv_traceStatsDump", "0", 0 );
+}
+
+/*
+===============
+SV_SectorList_f
+===============
+*/
+void SV_SectorList_f( void ) {
+	if ( !sv_broadphaseImpl ) {
+		Com_Printf( "No world loaded.\n" );
+		return;
+	}
+	Com_Printf( "%s\n", sv_broadphaseImpl->name );
+	sv_broadphaseImpl->SectorList();
+	Com_Printf( "sweep list: %i sorted, %i wide, %i swaps\n", sv_sweep.numSorted, sv_sweep.numWide, sv_sweep.swaps );
 }
 
+static void SV_ClearG2TraceCache( void );
+
 /*
 ===============
 SV_ClearWorld
@@ -132,15 +1348,35 @@ void SV_ClearWorld( void ) {
 	clipHandle_t	h;
 	vec3_t			mins, maxs;
 
-	Com_Memset( sv_worldSectors, 0, sizeof(sv_worldSectors) );
-	sv_numworldSectors = 0;
+	if ( sv_broadphase && sv_broadphase->integer == 1 ) {
+		sv_broadphaseImpl = &sv_octreeBroadphase;
+	} else {
+		sv_broadphaseImpl = &sv_uniformBroadphase;
+	}
+
+	SV_ReleaseCollisionLock();
 
 	// get world map bounds
 	h = CM_InlineModel( 0 );
 	CM_ModelBounds( h, mins, maxs );
-	SV_CreateworldSector( 0, mins, maxs );
+	SV_ClearSectorBlocks();
+	SV_ClearG2TraceCache();
+	SV_SweepClear();
+	sv_broadphaseImpl->Clear( mins, maxs );
 }
 
+/*
+===============
+SV_SectorVacated
+
+Lets the broadphase tidy up after the last entity left a sector
+===============
+*/
+static void SV_SectorVacated( worldSector_t *ws ) {
+	if ( ws && !ws->numEntities && sv_broadphaseImpl->SectorEmptied ) {
+		sv_broadphaseImpl->SectorEmptied( ws );
+	}
+}
 
 /*
 ===============
@@ -150,32 +1386,17 @@ SV_UnlinkEntity
 */
 void SV_UnlinkEntity( sharedEntity_t *gEnt ) {
 	svEntity_t		*ent;
-	svEntity_t		*scan;
-	worldSector_t	*ws;
 
 	ent = SV_SvEntityForGentity( gEnt );
 
 	gEnt->r.linked = qfalse;
 
-	ws = ent->worldSector;
-	if ( !ws ) {
+	if ( !ent->worldSector ) {
 		return;		// not linked in anywhere
 	}
-	ent->worldSector = NULL;
-
-	if ( ws->entities == ent ) {
-		ws->entities = ent->nextEntityInWorldSector;
-		return;
-	}
 
-	for ( scan = ws->entities ; scan ; scan = scan->nextEntityInWorldSector ) {
-		if ( scan->nextEntityInWorldSector == ent ) {
-			scan->nextEntityInWorldSector = ent->nextEntityInWorldSector;
-			return;
-		}
-	}
-
-	Com_Printf( "WARNING: SV_UnlinkEntity: not found in worldSector\n" );
+	SV_SweepRemove( ent - sv.svEntities );
+	SV_SectorVacated( SV_RemoveFromSector( ent ) );
 }
 
 
@@ -187,7 +1408,7 @@ SV_LinkEntity
 */
 #define MAX_TOTAL_ENT_LEAFS		128
 void SV_LinkEntity( sharedEntity_t *gEnt ) {
-	worldSector_t	*node;
+	worldSector_t	*node, *oldSector;
 	int			leafs[MAX_TOTAL_ENT_LEAFS];
 	int			cluster;
 	int			num_leafs;
@@ -199,10 +1420,6 @@ void SV_LinkEntity( sharedEntity_t *gEnt ) {
 
 	ent = SV_SvEntityForGentity( gEnt );
 
-	if ( ent->worldSector ) {
-		SV_UnlinkEntity( gEnt );	// unlink from old position
-	}
-
 	// encode the size into the entityState_t for client prediction
 	if ( gEnt->r.bmodel ) {
 		gEnt->s.solid = SOLID_BMODEL;		// a solid_box will never create this value
@@ -270,6 +1487,23 @@ void SV_LinkEntity( sharedEntity_t *gEnt ) {
 	gEnt->r.absmax[1] += 1;
 	gEnt->r.absmax[2] += 1;
 
+	// the leafs, clusters, areas and sector only depend on the abs box,
+	// nothing to redo if the entity is still linked with the same one
+	if ( ent->worldSector && SV_EntityHasBounds( ent, gEnt->r.absmin, gEnt->r.absmax ) ) {
+		SV_RelinkInSector( ent );
+		gEnt->r.linkcount++;
+		gEnt->r.linked = qtrue;
+		return;
+	}
+
+	// unlink from old position, the old sector is only given back
+	// once we know the entity didn't just land in it again
+	oldSector = NULL;
+	if ( ent->worldSector ) {
+		gEnt->r.linked = qfalse;
+		oldSector = SV_RemoveFromSector( ent );
+	}
+
 	// link to PVS leafs
 	ent->numClusters = 0;
 	ent->lastCluster = 0;
@@ -283,6 +1517,10 @@ void SV_LinkEntity( sharedEntity_t *gEnt ) {
 	// if none of the leafs were inside the map, the
 	// entity is outside the world and can be considered unlinked
 	if ( !num_leafs ) {
+		if ( oldSector ) {
+			SV_SweepRemove( gEnt->s.number );
+		}
+		SV_SectorVacated( oldSector );
 		return;
 	}
 
@@ -308,111 +1546,46 @@ void SV_LinkEntity( sharedEntity_t *gEnt ) {
 	// store as many explicit clusters as we can
 	ent->numClusters = 0;
 	for (i=0 ; i < num_leafs ; i++) {
-		cluster = CM_LeafCluster( leafs[i] );
-		if ( cluster != -1 ) {
-			ent->clusternums[ent->numClusters++] = cluster;
-			if ( ent->numClusters == MAX_ENT_CLUSTERS ) {
-				break;
-			}
-		}
-	}
-
-	// store off a last cluster if we need to
-	if ( i != num_leafs ) {
-		ent->lastCluster = CM_LeafCluster( lastLeaf );
-	}
-
-	gEnt->r.linkcount++;
-
-	// find the first world sector node that the ent's box crosses
-	node = sv_worldSectors;
-	while (1)
-	{
-		if (node->axis == -1)
-			break;
-		if ( gEnt->r.absmin[node->axis] > node->dist)
-			node = node->children[0];
-		else if ( gEnt->r.absmax[node->axis] < node->dist)
-			node = node->children[1];
-		else
-			break;		// crosses the node
-	}
-	
-	// link it in
-	ent->worldSector = node;
-	ent->nextEntityInWorldSector = node->entities;
-	node->entities = ent;
-
-	gEnt->r.linked = qtrue;
-}
-
-/*
-============================================================================
-
-AREA QUERY
-
-Fills in a list of all entities who's absmin / absmax intersects the given
-bounds.  This does NOT mean that they actually touch in the case of bmodels.
-============================================================================
-*/
-
-typedef struct {
-	const float	*mins;
-	const float	*maxs;
-	int			*list;
-	int			count, maxcount;
-} areaParms_t;
-
-
-/*
-====================
-SV_AreaEntities_r
-
-====================
-*/
-void SV_AreaEntities_r( worldSector_t *node, areaParms_t *ap ) {
-	svEntity_t	*check, *next;
-	sharedEntity_t *gcheck;
-	int			count;
-
-	count = 0;
-
-	for ( check = node->entities  ; check ; check = next ) {
-		next = check->nextEntityInWorldSector;
-
-		gcheck = SV_GEntityForSvEntity( check );
-
-		if ( gcheck->r.absmin[0] > ap->maxs[0]
-		|| gcheck->r.absmin[1] > ap->maxs[1]
-		|| gcheck->r.absmin[2] > ap->maxs[2]
-		|| gcheck->r.absmax[0] < ap->mins[0]
-		|| gcheck->r.absmax[1] < ap->mins[1]
-		|| gcheck->r.absmax[2] < ap->mins[2]) {
-			continue;
-		}
-
-		if ( ap->count == ap->maxcount ) {
-			Com_DPrintf ("SV_AreaEntities: MAXCOUNT\n");
-			return;
+		cluster = CM_LeafCluster( leafs[i] );
+		if ( cluster != -1 ) {
+			ent->clusternums[ent->numClusters++] = cluster;
+			if ( ent->numClusters == MAX_ENT_CLUSTERS ) {
+				break;
+			}
 		}
+	}
 
-		ap->list[ap->count] = check - sv.svEntities;
-		ap->count++;
+	// store off a last cluster if we need to
+	if ( i != num_leafs ) {
+		ent->lastCluster = CM_LeafCluster( lastLeaf );
 	}
+
+	gEnt->r.linkcount++;
+
+	// find the sector the broadphase wants it in
+	node = sv_broadphaseImpl->SectorForBounds( gEnt->r.absmin, gEnt->r.absmax );
 	
-	if (node->axis == -1) {
-		return;		// terminal node
-	}
+	// link it in
+	SV_AddToSector( node, ent, gEnt->r.absmin, gEnt->r.absmax );
+	SV_SweepUpdate( gEnt->s.number, gEnt->r.absmin, gEnt->r.absmax );
 
-	// recurse down both sides
-	if ( ap->maxs[node->axis] > node->dist ) {
-		SV_AreaEntities_r ( node->children[0], ap );
-	}
-	if ( ap->mins[node->axis] < node->dist ) {
-		SV_AreaEntities_r ( node->children[1], ap );
+	if ( oldSector != node ) {
+		SV_SectorVacated( oldSector );
 	}
+
+	gEnt->r.linked = qtrue;
 }
 
+/*
+============================================================================
+
+AREA QUERY
+
+Fills in a list of all entities who's absmin / absmax intersects the given
+bounds.  This does NOT mean that they actually touch in the case of bmodels.
+============================================================================
+*/
+
 /*
 ================
 SV_AreaEntities
@@ -420,6 +1593,9 @@ SV_AreaEntities
 */
 int SV_AreaEntities( const vec3_t mins, const vec3_t maxs, int *entityList, int maxcount ) {
 	areaParms_t		ap;
+	long long		start;
+
+	start = SV_TraceStatsStart();
 
 	ap.mins = mins;
 	ap.maxs = maxs;
@@ -427,8 +1603,9 @@ int SV_AreaEntities( const vec3_t mins, const vec3_t maxs, int *entityList, int
 	ap.count = 0;
 	ap.maxcount = maxcount;
 
-	SV_AreaEntities_r( sv_worldSectors, &ap );
+	sv_broadphaseImpl->AreaEntities( &ap );
 
+	SV_TraceStatsEnd( TRACEOP_AREAENTITIES, start );
 	return ap.count;
 }
 
@@ -483,9 +1660,6 @@ void SV_ClipToEntity( trace_t *trace, const vec3_t start, const vec3_t mins, con
 		return;
 	}
 
-	// might intersect, so do an exact clip
-	clipHandle = SV_ClipHandleForEntity (touch);
-
 	origin = touch->r.currentOrigin;
 	angles = touch->r.currentAngles;
 
@@ -493,9 +1667,16 @@ void SV_ClipToEntity( trace_t *trace, const vec3_t start, const vec3_t mins, con
 		angles = vec3_origin;	// boxes don't rotate
 	}
 
-	CM_TransformedBoxTrace ( trace, (float *)start, (float *)end,
-		(float *)mins, (float *)maxs, clipHandle,  contentmask,
-		origin, angles, capsule);
+	// might intersect, so do an exact clip
+	{
+		collisionLock_t	lock;
+
+		clipHandle = SV_ClipHandleForEntity (touch);
+
+		CM_TransformedBoxTrace ( trace, (float *)start, (float *)end,
+			(float *)mins, (float *)maxs, clipHandle,  contentmask,
+			origin, angles, capsule);
+	}
 
 	if ( trace->fraction < 1 ) {
 		trace->entityNum = touch->s.number;
@@ -503,6 +1684,199 @@ void SV_ClipToEntity( trace_t *trace, const vec3_t start, const vec3_t mins, con
 }
 
 
+/*
+===============================================================================
+
+GHOUL2 TRACE CACHE
+
+G2API_CollisionDetectCache keeps a model's transformed collision data around
+and only rebuilds it for a new frame, instead of transforming the whole
+skeleton for every trace like G2API_CollisionDetect.  Stock servers only
+use it for vehicles under com_optvehtrace, and that path is left exactly as
+it was.  sv_g2TraceCache extends it to every model: the server tracks the
+pose every entity was last transformed with, so a model that moved, turned
+or was rescaled between two traces in the same frame gets its skeleton
+rebuilt.  Bone overrides and animation changes made between two traces in
+the same frame are not part of that pose and are not noticed, which is why
+the cache is off by default.
+
+===============================================================================
+*/
+
+typedef struct {
+	int			time;			// svs.time of the last transform
+	const void	*ghoul2;
+	vec3_t		origin;
+	vec3_t		angles;
+	vec3_t		scale;
+} g2TraceCache_t;
+
+typedef struct {
+	int			hits;			// traces that reused this frame's transform
+	int			misses;			// traces that had to transform the model
+	int			uncached;		// traces that went through G2API_CollisionDetect
+	int			vehicles;		// traces that took the stock com_optvehtrace path
+	int			prechecked;		// traces tested against the model's sphere first
+	int			rejected;		// of those, the ones that couldn't reach the model
+} g2TraceStats_t;
+
+static g2TraceCache_t	sv_g2TraceCaches[MAX_GENTITIES];
+static g2TraceStats_t	sv_g2TraceStats;
+
+static void SV_ClearG2TraceCache( void ) {
+	Com_Memset( sv_g2TraceCaches, 0, sizeof( sv_g2TraceCaches ) );
+}
+
+/*
+====================
+SV_InvalidateG2Skeleton
+
+The ghoul2 code only rebuilds a model's bones when mSkelFrameNum differs
+from the frame it is asked for, and the server asks for svs.time.  Zeroing
+it forces the next collision to transform the model again.  This relies on
+the ghoul2 internals, it is only reached with sv_g2TraceCache on.
+====================
+*/
+static void SV_InvalidateG2Skeleton( CGhoul2Info_v &ghoul2 ) {
+	int		i;
+
+	for ( i = 0 ; i < ghoul2.size() ; i++ ) {
+		ghoul2[i].mSkelFrameNum = 0;
+	}
+}
+
+/*
+====================
+SV_UseG2TraceCache
+
+Decides whether the trace against touch goes through the transform cache,
+invalidates the model's skeleton when its pose changed within the frame.
+With sv_g2TraceCache off only vehicles use it, as they always have, and
+their skeletons are never touched.  Called with the collision lock held.
+====================
+*/
+static qboolean SV_UseG2TraceCache( sharedEntity_t *touch, const vec3_t angles ) {
+	g2TraceCache_t	*cache;
+
+	if ( !sv_g2TraceCache->integer ) {
+		if ( com_optvehtrace &&
+			com_optvehtrace->integer &&
+			touch->s.eType == ET_NPC &&
+			touch->s.NPC_class == CLASS_VEHICLE &&
+			touch->m_pVehicle ) {
+			//for vehicles cache the transform data.
+			sv_g2TraceStats.vehicles++;
+			return qtrue;
+		}
+		sv_g2TraceStats.uncached++;
+		return qfalse;
+	}
+
+	cache = &sv_g2TraceCaches[touch->s.number];
+	if ( cache->time == svs.time
+		&& cache->ghoul2 == touch->ghoul2
+		&& VectorCompare( cache->origin, touch->r.currentOrigin )
+		&& VectorCompare( cache->angles, angles )
+		&& VectorCompare( cache->scale, touch->modelScale ) ) {
+		sv_g2TraceStats.hits++;
+		return qtrue;
+	}
+
+	if ( cache->time == svs.time ) {
+		// same frame time, the ghoul2 code would think it is still current
+		SV_InvalidateG2Skeleton( *(CGhoul2Info_v *)touch->ghoul2 );
+	}
+
+	cache->time = svs.time;
+	cache->ghoul2 = touch->ghoul2;
+	VectorCopy( touch->r.currentOrigin, cache->origin );
+	VectorCopy( angles, cache->angles );
+	VectorCopy( touch->modelScale, cache->scale );
+	sv_g2TraceStats.misses++;
+
+	return qtrue;
+}
+
+/*
+====================
+SV_G2TraceMissesModel
+
+Cheap test before the mesh collision, the move can't touch the model if it
+never comes within the model's g2radius of its origin.  The game sets
+g2radius to cover the model in any pose, so this is only done when
+sv_g2TracePrecheck asks for it.  Called with the collision lock held.
+====================
+*/
+static qboolean SV_G2TraceMissesModel( const sharedEntity_t *touch, const moveclip_t *clip, float fRadius ) {
+	vec3_t	dir, toOrigin, closest;
+	float	radius, scale, length, t;
+	int		i;
+
+	if ( !sv_g2TracePrecheck->integer || touch->s.g2radius <= 0 ) {
+		return qfalse;
+	}
+
+	// a scale of 0 leaves the model at its normal size
+	scale = 1.0f;
+	for ( i = 0 ; i < 3 ; i++ ) {
+		if ( touch->modelScale[i] > scale ) {
+			scale = touch->modelScale[i];
+		}
+	}
+	radius = touch->s.g2radius * scale + fRadius;
+
+	// closest point of the move to the model's origin
+	VectorSubtract( clip->end, clip->start, dir );
+	VectorSubtract( touch->r.currentOrigin, clip->start, toOrigin );
+	length = DotProduct( dir, dir );
+	t = length > 0 ? DotProduct( toOrigin, dir ) / length : 0;
+	if ( t < 0 ) {
+		t = 0;
+	} else if ( t > 1 ) {
+		t = 1;
+	}
+	VectorMA( clip->start, t, dir, closest );
+	VectorSubtract( touch->r.currentOrigin, closest, toOrigin );
+
+	sv_g2TraceStats.prechecked++;
+	if ( DotProduct( toOrigin, toOrigin ) > radius * radius ) {
+		sv_g2TraceStats.rejected++;
+		return qtrue;
+	}
+	return qfalse;
+}
+
+/*
+===============
+SV_G2TraceStats_f
+
+Reports how well the ghoul2 trace cache is doing
+
+g2tracestats [reset]
+===============
+*/
+void SV_G2TraceStats_f( void ) {
+	int		cached;
+
+	if ( !Q_stricmp( Cmd_Argv( 1 ), "reset" ) ) {
+		Com_Memset( &sv_g2TraceStats, 0, sizeof( sv_g2TraceStats ) );
+		return;
+	}
+
+	cached = sv_g2TraceStats.hits + sv_g2TraceStats.misses;
+	Com_Printf( "cache hits: %i\n", sv_g2TraceStats.hits );
+	Com_Printf( "cache misses: %i\n", sv_g2TraceStats.misses );
+	if ( cached ) {
+		Com_Printf( "hit rate: %.1f%%\n", 100.0f * sv_g2TraceStats.hits / cached );
+	}
+	Com_Printf( "vehicle traces: %i\n", sv_g2TraceStats.vehicles );
+	Com_Printf( "uncached traces: %i\n", sv_g2TraceStats.uncached );
+	if ( sv_g2TraceStats.prechecked ) {
+		Com_Printf( "sphere precheck: %i / %i rejected (%.1f%%)\n", sv_g2TraceStats.rejected, sv_g2TraceStats.prechecked,
+			100.0f * sv_g2TraceStats.rejected / sv_g2TraceStats.prechecked );
+	}
+}
+
 /*
 ====================
 SV_ClipMoveToEntities
@@ -519,9 +1893,8 @@ static float VectorDistance(vec3_t p1, vec3_t p2)
 }
 #endif
 #pragma warning(disable : 4701) //local variable used without having been init
-static void SV_ClipMoveToEntities( moveclip_t *clip ) {
-	static int	touchlist[MAX_GENTITIES];
-	int			i, num;
+static void SV_ClipMoveToEntityList( moveclip_t *clip, const int *touchlist, int num ) {
+	int			i;
 	sharedEntity_t *touch;
 	int			passOwnerNum;
 	trace_t		trace, oldTrace= {0};
@@ -529,8 +1902,6 @@ static void SV_ClipMoveToEntities( moveclip_t *clip ) {
 	float		*origin, *angles;
 	int			thisOwnerShared = 1;
 
-	num = SV_AreaEntities( clip->boxmins, clip->boxmaxs, touchlist, MAX_GENTITIES);
-
 	if ( clip->passEntityNum != ENTITYNUM_NONE ) {
 		passOwnerNum = ( SV_GentityNum( clip->passEntityNum ) )->r.ownerNum;
 		if ( passOwnerNum == ENTITYNUM_NONE ) {
@@ -595,9 +1966,6 @@ static void SV_ClipMoveToEntities( moveclip_t *clip ) {
 			continue;
 		}
 
-		// might intersect, so do an exact clip
-		clipHandle = SV_ClipHandleForEntity (touch);
-
 		origin = touch->r.currentOrigin;
 		angles = touch->r.currentAngles;
 
@@ -606,9 +1974,16 @@ static void SV_ClipMoveToEntities( moveclip_t *clip ) {
 			angles = vec3_origin;	// boxes don't rotate
 		}
 
-		CM_TransformedBoxTrace ( &trace, (float *)clip->start, (float *)clip->end,
-			(float *)clip->mins, (float *)clip->maxs, clipHandle,  clip->contentmask,
-			origin, angles, clip->capsule);
+		// might intersect, so do an exact clip
+		{
+			collisionLock_t	lock;
+
+			clipHandle = SV_ClipHandleForEntity (touch);
+
+			CM_TransformedBoxTrace ( &trace, (float *)clip->start, (float *)clip->end,
+				(float *)clip->mins, (float *)clip->maxs, clipHandle,  clip->contentmask,
+				origin, angles, clip->capsule);
+		}
 
 
 		if (clip->traceFlags & G2TRFLAG_DOGHOULTRACE)
@@ -689,7 +2064,8 @@ Ghoul2 Insert Start
 		//this must be done somewhat differently.
 		if ((clip->traceFlags & G2TRFLAG_DOGHOULTRACE) && trace.entityNum == touch->s.number && touch->ghoul2 && ((clip->traceFlags & G2TRFLAG_HITCORPSES) || !(touch->s.eFlags & EF_DEAD)))
 		{ //standard behavior will be to ignore g2 col on dead ents, but if traceFlags is set to allow, then we'll try g2 col on EF_DEAD people too.
-			static G2Trace_t G2Trace;
+			G2Trace_t G2Trace;
+			long long g2Start;
 			vec3_t angles;
 			float fRadius = 0.0f;
 			int tN = 0;
@@ -709,6 +2085,14 @@ Ghoul2 Insert Start
 				}
 			}
 
+			collisionLock_t	lock;
+
+			if (SV_G2TraceMissesModel(touch, clip, fRadius))
+			{ //can't get anywhere near the mesh, put the trace back to the old one.
+				clip->trace = oldTrace;
+				continue;
+			}
+
 			memset (&G2Trace, 0, sizeof(G2Trace));
 			while (tN < MAX_G2_COLLISIONS)
 			{
@@ -735,12 +2119,10 @@ Ghoul2 Insert Start
 			}
 #endif
 
-			if (com_optvehtrace &&
-				com_optvehtrace->integer &&
-				touch->s.eType == ET_NPC &&
-				touch->s.NPC_class == CLASS_VEHICLE &&
-				touch->m_pVehicle)
-			{ //for vehicles cache the transform data.
+			g2Start = SV_TraceStatsStart();
+
+			if (SV_UseG2TraceCache(touch, angles))
+			{ //reuse the transform data from earlier traces this frame.
 				G2API_CollisionDetectCache(G2Trace, *((CGhoul2Info_v *)touch->ghoul2), angles, touch->r.currentOrigin, svs.time, touch->s.number, clip->start, clip->end, touch->modelScale, G2VertSpaceServer, 0, clip->useLod, fRadius);
 			}
 			else
@@ -748,6 +2130,8 @@ Ghoul2 Insert Start
 				G2API_CollisionDetect(G2Trace, *((CGhoul2Info_v *)touch->ghoul2), angles, touch->r.currentOrigin, svs.time, touch->s.number, clip->start, clip->end, touch->modelScale, G2VertSpaceServer, 0, clip->useLod, fRadius);
 			}
 
+			SV_TraceStatsEnd(TRACEOP_G2COLLISION, g2Start);
+
 			tN = 0;
 			while (tN < MAX_G2_COLLISIONS)
 			{
@@ -789,22 +2173,24 @@ Ghoul2 Insert End
 }
 #pragma warning(default : 4701) //local variable used without having been init
 
+static void SV_ClipMoveToEntities( moveclip_t *clip ) {
+	int			touchlist[MAX_GENTITIES];
+	int			num;
+
+	num = SV_AreaEntities( clip->boxmins, clip->boxmaxs, touchlist, MAX_GENTITIES);
+
+	SV_ClipMoveToEntityList( clip, touchlist, num );
+}
+
 /*
 ==================
-SV_Trace
+SV_StartTrace
 
-Moves the given mins/maxs volume through the world from start to end.
-passEntityNum and entities owned by passEntityNum are explicitly not checked.
+Clips the move against the world and sets up the clip for the entities,
+returns qfalse when the world already blocks it at the start
 ==================
 */
-/*
-Ghoul2 Insert Start
-*/
-void SV_Trace( trace_t *results, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int passEntityNum, int contentmask, int capsule, int traceFlags, int useLod ) {
-/*
-Ghoul2 Insert End
-*/
-	moveclip_t	clip;
+static qboolean SV_StartTrace( moveclip_t *clip, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int passEntityNum, int contentmask, int capsule, int traceFlags, int useLod ) {
 	int			i;
 
 	if ( !mins ) {
@@ -814,32 +2200,35 @@ Ghoul2 Insert End
 		maxs = vec3_origin;
 	}
 
-	Com_Memset ( &clip, 0, sizeof ( moveclip_t ) );
+	Com_Memset ( clip, 0, sizeof ( moveclip_t ) );
 
 	// clip to world
-	CM_BoxTrace( &clip.trace, start, end, mins, maxs, 0, contentmask, capsule );
-	clip.trace.entityNum = clip.trace.fraction != 1.0 ? ENTITYNUM_WORLD : ENTITYNUM_NONE;
-	if ( clip.trace.fraction == 0 ) {
-		*results = clip.trace;
-		return;		// blocked immediately by the world
+	{
+		collisionLock_t	lock;
+
+		CM_BoxTrace( &clip->trace, start, end, mins, maxs, 0, contentmask, capsule );
+	}
+	clip->trace.entityNum = clip->trace.fraction != 1.0 ? ENTITYNUM_WORLD : ENTITYNUM_NONE;
+	if ( clip->trace.fraction == 0 ) {
+		return qfalse;		// blocked immediately by the world
 	}
 
-	clip.contentmask = contentmask;
+	clip->contentmask = contentmask;
 /*
 Ghoul2 Insert Start
 */	
-	VectorCopy( start, clip.start );
-	clip.traceFlags = traceFlags;
-	clip.useLod = useLod;
+	VectorCopy( start, clip->start );
+	clip->traceFlags = traceFlags;
+	clip->useLod = useLod;
 /*
 Ghoul2 Insert End
 */
-//	VectorCopy( clip.trace.endpos, clip.end );
-	VectorCopy( end, clip.end );
-	clip.mins = mins;
-	clip.maxs = maxs;
-	clip.passEntityNum = passEntityNum;
-	clip.capsule = capsule;
+//	VectorCopy( clip->trace.endpos, clip->end );
+	VectorCopy( end, clip->end );
+	clip->mins = mins;
+	clip->maxs = maxs;
+	clip->passEntityNum = passEntityNum;
+	clip->capsule = capsule;
 
 	// create the bounding box of the entire move
 	// we can limit it to the part of the move not
@@ -847,18 +2236,143 @@ Ghoul2 Insert End
 	// a significant savings for line of sight and shot traces
 	for ( i=0 ; i<3 ; i++ ) {
 		if ( end[i] > start[i] ) {
-			clip.boxmins[i] = clip.start[i] + clip.mins[i] - 1;
-			clip.boxmaxs[i] = clip.end[i] + clip.maxs[i] + 1;
+			clip->boxmins[i] = clip->start[i] + clip->mins[i] - 1;
+			clip->boxmaxs[i] = clip->end[i] + clip->maxs[i] + 1;
 		} else {
-			clip.boxmins[i] = clip.end[i] + clip.mins[i] - 1;
-			clip.boxmaxs[i] = clip.start[i] + clip.maxs[i] + 1;
+			clip->boxmins[i] = clip->end[i] + clip->mins[i] - 1;
+			clip->boxmaxs[i] = clip->start[i] + clip->maxs[i] + 1;
 		}
 	}
 
-	// clip to other solid entities
-	SV_ClipMoveToEntities ( &clip );
+	return qtrue;
+}
+
+/*
+==================
+SV_Trace
+
+Moves the given mins/maxs volume through the world from start to end.
+passEntityNum and entities owned by passEntityNum are explicitly not checked.
+==================
+*/
+/*
+Ghoul2 Insert Start
+*/
+void SV_Trace( trace_t *results, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int passEntityNum, int contentmask, int capsule, int traceFlags, int useLod ) {
+/*
+Ghoul2 Insert End
+*/
+	moveclip_t	clip;
+	long long	statsStart;
+
+	statsStart = SV_TraceStatsStart();
+
+	if ( SV_StartTrace( &clip, start, mins, maxs, end, passEntityNum, contentmask, capsule, traceFlags, useLod ) ) {
+		// clip to other solid entities
+		SV_ClipMoveToEntities ( &clip );
+	}
 
 	*results = clip.trace;
+
+	SV_TraceStatsEnd( TRACEOP_TRACE, statsStart );
+}
+
+/*
+==================
+SV_TraceBatch
+
+Runs the requests in order, exactly as SV_Trace would.  Consecutive requests
+that stay close together are grouped, the group does one entity query over
+the box holding all of their moves, and every request then picks its own
+entities out of that list.  Since a smaller box visits a subset of the same
+sectors in the same order, each request sees the same entities in the same
+order a query of its own would have returned.
+==================
+*/
+#define	TRACE_BATCH_GROUP	32			// requests sharing one entity query
+#define	TRACE_BATCH_SPAN	1024		// largest group box extent on any axis
+
+void SV_TraceBatch( const traceRequest_t *requests, trace_t *results, int count ) {
+	moveclip_t			clips[TRACE_BATCH_GROUP];
+	int					grouplist[MAX_GENTITIES];
+	int					touchlist[MAX_GENTITIES];
+	const traceRequest_t	*req;
+	moveclip_t			*clip;
+	int					share[TRACE_BATCH_GROUP];		// -1 = blocked by the world, 0 = on its own, 1 = uses the group list
+	vec3_t				groupmins, groupmaxs;
+	int					first, numInGroup, numActive;
+	int					i, j, k, num, numTouch;
+	long long			statsStart;
+
+	statsStart = SV_TraceStatsStart();
+
+	for ( first = 0 ; first < count ; first += numInGroup ) {
+		numActive = 0;
+		for ( numInGroup = 0 ; numInGroup < TRACE_BATCH_GROUP && first + numInGroup < count ; numInGroup++ ) {
+			req = &requests[first + numInGroup];
+			clip = &clips[numInGroup];
+
+			if ( !SV_StartTrace( clip, req->start, req->mins, req->maxs, req->end,
+				req->passEntityNum, req->contentmask, req->capsule, req->traceFlags, req->useLod ) ) {
+				share[numInGroup] = -1;
+				continue;
+			}
+			share[numInGroup] = 1;
+
+			if ( !numActive ) {
+				VectorCopy( clip->boxmins, groupmins );
+				VectorCopy( clip->boxmaxs, groupmaxs );
+			} else {
+				for ( i = 0 ; i < 3 ; i++ ) {
+					if ( ( clip->boxmaxs[i] > groupmaxs[i] ? clip->boxmaxs[i] : groupmaxs[i] )
+						- ( clip->boxmins[i] < groupmins[i] ? clip->boxmins[i] : groupmins[i] ) > TRACE_BATCH_SPAN ) {
+						break;
+					}
+				}
+				if ( i < 3 ) {
+					share[numInGroup++] = 0;	// too far from the rest, it ends the group
+					break;
+				}
+				for ( i = 0 ; i < 3 ; i++ ) {
+					if ( clip->boxmins[i] < groupmins[i] ) {
+						groupmins[i] = clip->boxmins[i];
+					}
+					if ( clip->boxmaxs[i] > groupmaxs[i] ) {
+						groupmaxs[i] = clip->boxmaxs[i];
+					}
+				}
+			}
+			numActive++;
+		}
+
+		if ( numActive > 1 ) {
+			num = SV_AreaEntities( groupmins, groupmaxs, grouplist, MAX_GENTITIES );
+		} else {
+			num = 0;
+		}
+
+		for ( j = 0 ; j < numInGroup ; j++ ) {
+			clip = &clips[j];
+
+			if ( share[j] >= 0 ) {
+				if ( share[j] && numActive > 1 ) {
+					numTouch = 0;
+					for ( k = 0 ; k < num ; k++ ) {
+						if ( SV_EntityTouchesBox( &sv.svEntities[grouplist[k]], clip->boxmins, clip->boxmaxs ) ) {
+							touchlist[numTouch++] = grouplist[k];
+						}
+					}
+					SV_ClipMoveToEntityList( clip, touchlist, numTouch );
+				} else {
+					SV_ClipMoveToEntities( clip );
+				}
+			}
+
+			results[first + j] = clip->trace;
+		}
+	}
+
+	SV_TraceStatsEnd( TRACEOP_TRACEBATCH, statsStart );
 }
 
 
@@ -875,9 +2389,16 @@ int SV_PointContents( const vec3_t p, int passEntityNum ) {
 	int			contents, c2;
 	clipHandle_t	clipHandle;
 	float		*angles;
+	long long	statsStart;
+
+	statsStart = SV_TraceStatsStart();
 
 	// get base contents from world
-	contents = CM_PointContents( p, 0 );
+	{
+		collisionLock_t	lock;
+
+		contents = CM_PointContents( p, 0 );
+	}
 
 	// or in contents from all the other entities
 	num = SV_AreaEntities( p, p, touch, MAX_GENTITIES );
@@ -887,19 +2408,171 @@ int SV_PointContents( const vec3_t p, int passEntityNum ) {
 			continue;
 		}
 		hit = SV_GentityNum( touch[i] );
-		// might intersect, so do an exact clip
-		clipHandle = SV_ClipHandleForEntity( hit );
 		angles = hit->s.angles;
 		if ( !hit->r.bmodel ) {
 			angles = vec3_origin;	// boxes don't rotate
 		}
 
-		c2 = CM_TransformedPointContents (p, clipHandle, hit->s.origin, hit->s.angles);
+		// might intersect, so do an exact clip
+		{
+			collisionLock_t	lock;
+
+			clipHandle = SV_ClipHandleForEntity( hit );
+			c2 = CM_TransformedPointContents (p, clipHandle, hit->s.origin, hit->s.angles);
+		}
 
 		contents |= c2;
 	}
 
+	SV_TraceStatsEnd( TRACEOP_POINTCONTENTS, statsStart );
 	return contents;
 }
 
+/*
+===============================================================================
+
+TRACE STRESS TEST
+
+===============================================================================
+*/
+
+#define	TRACETEST_MAX_TRACES	16384
+#define	TRACETEST_MAX_THREADS	16
+
+typedef struct {
+	const traceRequest_t	*requests;
+	trace_t					*results;
+	int						count;
+	int						thread, numThreads;
+} traceTestJob_t;
+
+static void SV_TraceTestWorker( traceTestJob_t *job ) {
+	const traceRequest_t	*req;
+	int						i;
+
+	// interleave the requests so every thread works all over the map
+	for ( i = job->thread ; i < job->count ; i += job->numThreads ) {
+		req = &job->requests[i];
+		SV_Trace( &job->results[i], req->start, req->mins, req->maxs, req->end,
+			req->passEntityNum, req->contentmask, req->capsule, req->traceFlags, req->useLod );
+	}
+}
+
+static qboolean SV_TraceTestCompare( const trace_t *a, const trace_t *b ) {
+	return (qboolean)( a->allsolid == b->allsolid
+		&& a->startsolid == b->startsolid
+		&& a->entityNum == b->entityNum
+		&& a->fraction == b->fraction
+		&& VectorCompare( a->endpos, b->endpos )
+		&& VectorCompare( a->plane.normal, b->plane.normal )
+		&& a->plane.dist == b->plane.dist
+		&& a->surfaceFlags == b->surfaceFlags
+		&& a->contents == b->contents );
+}
+
+/*
+===============
+SV_TraceTest_f
+
+Runs the same random traces serially and from several threads at once and
+checks that they come out identical
+
+tracetest [traces] [threads]
+===============
+*/
+void SV_TraceTest_f( void ) {
+	traceRequest_t	*requests;
+	trace_t			*serial, *parallel;
+	traceTestJob_t	jobs[TRACETEST_MAX_THREADS];
+	std::thread		*threads[TRACETEST_MAX_THREADS];
+	vec3_t			worldMins, worldMaxs;
+	unsigned int	seed;
+	int				count, numThreads, i, j, mismatches;
+	int				serialMsec, parallelMsec, start;
+
+	if ( sv.state != SS_GAME ) {
+		Com_Printf( "Server is not running.\n" );
+		return;
+	}
+
+	count = Cmd_Argc() > 1 ? atoi( Cmd_Argv( 1 ) ) : 4096;
+	numThreads = Cmd_Argc() > 2 ? atoi( Cmd_Argv( 2 ) ) : 4;
+	if ( count < 1 || count > TRACETEST_MAX_TRACES ) {
+		Com_Printf( "traces must be between 1 and %i\n", TRACETEST_MAX_TRACES );
+		return;
+	}
+	if ( numThreads < 1 || numThreads > TRACETEST_MAX_THREADS ) {
+		Com_Printf( "threads must be between 1 and %i\n", TRACETEST_MAX_THREADS );
+		return;
+	}
+
+	requests = (traceRequest_t *)Z_Malloc( count * sizeof( *requests ), TAG_GENERAL, qtrue );
+	serial = (trace_t *)Z_Malloc( count * sizeof( *serial ), TAG_GENERAL, qtrue );
+	parallel = (trace_t *)Z_Malloc( count * sizeof( *parallel ), TAG_GENERAL, qtrue );
 
+	CM_ModelBounds( CM_InlineModel( 0 ), worldMins, worldMaxs );
+
+	// same set every run, a mix of lines, player boxes, capsules and ghoul2 shots
+	seed = 0x1234567;
+	for ( i = 0 ; i < count ; i++ ) {
+		traceRequest_t	*req = &requests[i];
+
+		for ( j = 0 ; j < 3 ; j++ ) {
+			seed = seed * 1103515245 + 12345;
+			req->start[j] = worldMins[j] + ( worldMaxs[j] - worldMins[j] ) * ( ( seed >> 8 ) & 0xffff ) / 65535.0f;
+			seed = seed * 1103515245 + 12345;
+			req->end[j] = req->start[j] + ( (int)( ( seed >> 8 ) & 0x7ff ) - 1024 );
+		}
+		if ( i & 1 ) {
+			VectorSet( req->mins, -15, -15, -24 );
+			VectorSet( req->maxs, 15, 15, 40 );
+		}
+		req->passEntityNum = ENTITYNUM_NONE;
+		req->contentmask = MASK_SHOT;
+		req->capsule = ( i % 5 ) == 0;
+		req->traceFlags = ( i % 7 ) == 0 ? G2TRFLAG_DOGHOULTRACE : 0;
+		req->useLod = 10;
+	}
+
+	start = Sys_Milliseconds();
+	for ( i = 0 ; i < count ; i++ ) {
+		const traceRequest_t	*req = &requests[i];
+
+		SV_Trace( &serial[i], req->start, req->mins, req->maxs, req->end,
+			req->passEntityNum, req->contentmask, req->capsule, req->traceFlags, req->useLod );
+	}
+	serialMsec = Sys_Milliseconds() - start;
+
+	start = Sys_Milliseconds();
+	for ( i = 0 ; i < numThreads ; i++ ) {
+		jobs[i].requests = requests;
+		jobs[i].results = parallel;
+		jobs[i].count = count;
+		jobs[i].thread = i;
+		jobs[i].numThreads = numThreads;
+		threads[i] = new std::thread( SV_TraceTestWorker, &jobs[i] );
+	}
+	for ( i = 0 ; i < numThreads ; i++ ) {
+		threads[i]->join();
+		delete threads[i];
+	}
+	parallelMsec = Sys_Milliseconds() - start;
+
+	mismatches = 0;
+	for ( i = 0 ; i < count ; i++ ) {
+		if ( !SV_TraceTestCompare( &serial[i], &parallel[i] ) ) {
+			if ( mismatches < 10 ) {
+				Com_Printf( "trace %i differs: fraction %f / %f, entity %i / %i\n", i,
+					serial[i].fraction, parallel[i].fraction, serial[i].entityNum, parallel[i].entityNum );
+			}
+			mismatches++;
+		}
+	}
+
+	Com_Printf( "%i traces: serial %i msec, %i threads %i msec, %i mismatches\n",
+		count, serialMsec, numThreads, parallelMsec, mismatches );
+
+	Z_Free( parallel );
+	Z_Free( serial );
+	Z_Free( requests );
+}